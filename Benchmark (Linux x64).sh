@@ -0,0 +1,20 @@
+cd "${0%/*}"
+
+mkdir "Benchmark (x64)"
+mkdir "Benchmark (x64)/Linux"
+mkdir "Benchmark (x64)/Linux/bin"
+g++ "DlgModule/Universal/dlgmodule.cpp" "DlgModule/xlib/dlgmodule.cpp" "DlgModule/xlib/lodepng.cpp" -o "Benchmark (x64)/Linux/libdlgmod.so" -std=c++17 -shared -static-libgcc -static-libstdc++ -lpthread -ldl -fPIC -m64
+gcc "Benchmark/xlib/fake_engine.c" -o "Benchmark (x64)/Linux/bin/zenity" -lxcb -m64
+cp "Benchmark (x64)/Linux/bin/zenity" "Benchmark (x64)/Linux/bin/kdialog"
+g++ "Benchmark/xlib/latency.cpp" -o "Benchmark (x64)/Linux/latency" -std=c++17 -L"Benchmark (x64)/Linux" -ldlgmod -lxcb -Wl,-rpath,'$ORIGIN' -m64
+g++ "Benchmark/xlib/stress.cpp" -o "Benchmark (x64)/Linux/stress" -std=c++17 -L"Benchmark (x64)/Linux" -ldlgmod -lpthread -Wl,-rpath,'$ORIGIN' -m64
+g++ "Benchmark/xlib/helpers.cpp" "DlgModule/xlib/lodepng.cpp" -o "Benchmark (x64)/Linux/helpers" -std=c++17 -O2 -lbenchmark -lpthread -ldl -m64
+
+"Benchmark (x64)/Linux/helpers"
+
+Xvfb :99 -screen 0 1280x1024x24 &
+XVFB=$!
+sleep 1
+DISPLAY=:99 PATH="$PWD/Benchmark (x64)/Linux/bin:$PATH" "Benchmark (x64)/Linux/latency" "$@"
+DISPLAY=:99 PATH="$PWD/Benchmark (x64)/Linux/bin:$PATH" "Benchmark (x64)/Linux/stress"
+kill $XVFB
@@ -0,0 +1,175 @@
+/*
+
+ MIT License
+
+ Copyright © 2021 Samuel Venable
+ Copyright © 2021 Robert B. Colton
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+*/
+
+// stand-in for zenity and kdialog, built once under each name because the
+// window decorator checks the executable's name. it maps a window carrying
+// its _NET_WM_PID, makes it the active window the way a window manager
+// would, waits DLGMOD_FAKE_DELAY milliseconds while watching for the
+// decorator's _NET_WM_NAME, then prints the answer the real program would.
+// one line per run goes to DLGMOD_FAKE_LOG: start, mapped, decorated and
+// answered, in CLOCK_MONOTONIC nanoseconds, decorated being 0 if never seen
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int has_flag(int argc, char **argv, const char *flag) {
+  for (int i = 1; i < argc; i++)
+    if (strcmp(argv[i], flag) == 0) return 1;
+  return 0;
+}
+
+static xcb_atom_t intern(xcb_connection_t *connection, const char *name) {
+  xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(connection,
+    xcb_intern_atom(connection, 0, strlen(name), name), NULL);
+  xcb_atom_t atom = reply ? reply->atom : XCB_ATOM_NONE;
+  free(reply);
+  return atom;
+}
+
+static void drain_stdin(void) {
+  char buffer[65536];
+  while (read(STDIN_FILENO, buffer, sizeof(buffer)) > 0);
+}
+
+// the first line of stdin, for list dialogs fed their rows that way
+static void first_line(char *line, size_t size) {
+  line[0] = '\0';
+  if (fgets(line, (int)size, stdin)) line[strcspn(line, "\n")] = '\0';
+  drain_stdin();
+}
+
+static const char *zenity_answer(int argc, char **argv, char *line, size_t size) {
+  if (has_flag(argc, argv, "--entry") || has_flag(argc, argv, "--forms")) return "42";
+  if (has_flag(argc, argv, "--color-selection")) return "rgb(255,0,0)";
+  if (has_flag(argc, argv, "--file-selection")) {
+    if (has_flag(argc, argv, "--directory")) return "/tmp";
+    if (has_flag(argc, argv, "--save")) return "/tmp/dlgmod-benchmark.txt";
+    if (has_flag(argc, argv, "--multiple")) return "/etc/hostname\n/etc/passwd";
+    return "/etc/hostname";
+  }
+  if (has_flag(argc, argv, "--list")) {
+    first_line(line, size);
+    return line;
+  }
+  if (has_flag(argc, argv, "--text-info") || has_flag(argc, argv, "--progress") ||
+    has_flag(argc, argv, "--notification")) drain_stdin();
+  return NULL;
+}
+
+static const char *kdialog_answer(int argc, char **argv) {
+  if (has_flag(argc, argv, "--inputbox") || has_flag(argc, argv, "--password") ||
+    has_flag(argc, argv, "--combobox")) return "42";
+  if (has_flag(argc, argv, "--getcolor")) return "#FF0000";
+  if (has_flag(argc, argv, "--getexistingdirectory")) return "/tmp";
+  if (has_flag(argc, argv, "--getsavefilename")) return "/tmp/dlgmod-benchmark.txt";
+  if (has_flag(argc, argv, "--getopenfilename"))
+    return has_flag(argc, argv, "--multiple") ? "/etc/hostname\n/etc/passwd" : "/etc/hostname";
+  if (has_flag(argc, argv, "--menu")) {
+    for (int i = 1; i + 2 < argc; i++)
+      if (strcmp(argv[i], "--menu") == 0) return argv[i + 2];
+  }
+  if (has_flag(argc, argv, "--textbox")) drain_stdin();
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  uint64_t start = now_ns(), mapped = 0, decorated = 0, answered = 0;
+  const char *name = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+  const char *delay_env = getenv("DLGMOD_FAKE_DELAY");
+  uint64_t delay = (uint64_t)(delay_env ? atof(delay_env) : 50) * 1000000ull;
+
+  // stdin is read before the window shows, as the real programs load first
+  char line[4096];
+  const char *answer = (strcmp(name, "kdialog") == 0) ? kdialog_answer(argc, argv) :
+    zenity_answer(argc, argv, line, sizeof(line));
+  // error dialogs answer ignore, as abort makes the library exit the caller
+  int status = ((strcmp(name, "kdialog") == 0) ? has_flag(argc, argv, "--warningyesno") :
+    (has_flag(argc, argv, "--question") && has_flag(argc, argv, "--icon-name=dialog-error"))) ? 1 : 0;
+
+  xcb_connection_t *connection = xcb_connect(NULL, NULL);
+  if (!xcb_connection_has_error(connection)) {
+    xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(connection)).data;
+    xcb_atom_t wm_pid = intern(connection, "_NET_WM_PID");
+    xcb_atom_t wm_name = intern(connection, "_NET_WM_NAME");
+    xcb_atom_t active_window = intern(connection, "_NET_ACTIVE_WINDOW");
+    xcb_window_t window = xcb_generate_id(connection);
+    uint32_t events = XCB_EVENT_MASK_PROPERTY_CHANGE;
+    uint32_t pid = (uint32_t)getpid();
+    xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, screen->root, 0, 0, 320, 120, 0,
+      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, XCB_CW_EVENT_MASK, &events);
+    xcb_change_property(connection, XCB_PROP_MODE_REPLACE, window, wm_pid, XCB_ATOM_CARDINAL, 32, 1, &pid);
+    xcb_map_window(connection, window);
+    xcb_change_property(connection, XCB_PROP_MODE_REPLACE, screen->root, active_window, XCB_ATOM_WINDOW, 32, 1, &window);
+    // a reply means everything before it has been processed by the server
+    free(xcb_get_input_focus_reply(connection, xcb_get_input_focus(connection), NULL));
+    mapped = now_ns();
+    struct pollfd pfd = { xcb_get_file_descriptor(connection), POLLIN, 0 };
+    for (uint64_t now = mapped; now < mapped + delay; now = now_ns()) {
+      xcb_generic_event_t *event;
+      while ((event = xcb_poll_for_event(connection))) {
+        if ((event->response_type & 0x7f) == XCB_PROPERTY_NOTIFY && !decorated &&
+          ((xcb_property_notify_event_t *)event)->atom == wm_name) decorated = now_ns();
+        free(event);
+      }
+      poll(&pfd, 1, (int)((mapped + delay - now) / 1000000) + 1);
+    }
+  } else {
+    mapped = now_ns();
+    struct timespec ts = { (time_t)(delay / 1000000000ull), (long)(delay % 1000000000ull) };
+    nanosleep(&ts, NULL);
+  }
+
+  answered = now_ns();
+  if (answer) printf("%s\n", answer);
+  fflush(stdout);
+  const char *log = getenv("DLGMOD_FAKE_LOG");
+  if (log) {
+    char record[128];
+    int length = snprintf(record, sizeof(record), "%llu %llu %llu %llu\n", (unsigned long long)start,
+      (unsigned long long)mapped, (unsigned long long)decorated, (unsigned long long)answered);
+    int fd = open(log, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd != -1) {
+      if (write(fd, record, length) != length) perror("DLGMOD_FAKE_LOG");
+      close(fd);
+    }
+  }
+  xcb_disconnect(connection);
+  return status;
+}
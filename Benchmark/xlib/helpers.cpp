@@ -0,0 +1,214 @@
+/*
+
+ MIT License
+
+ Copyright © 2021 Samuel Venable
+ Copyright © 2021 Robert B. Colton
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+*/
+
+// microbenchmarks of the string helpers every dialog runs through when its
+// command is built and its answer parsed. the library source is included
+// whole so its anonymous namespace can be reached; link lodepng.cpp beside
+// it. the adversarial cases are meant to be slow until these helpers stop
+// copying the string on every replacement
+
+#include <benchmark/benchmark.h>
+
+#include "../../DlgModule/xlib/dlgmodule.cpp"
+
+namespace {
+
+using namespace dialog_module;
+
+// text with a quote every sixteen characters, as in a quoted error message
+string message_text(size_t length) {
+  string text;
+  text.reserve(length);
+  const char *sample = "Can't open \"config.ini\": the file is locked by \"editor\"; retry? ";
+  while (text.length() < length) text += sample;
+  text.resize(length);
+  return text;
+}
+
+// description and pattern pairs, half of them with several extensions
+string filter_text(size_t pairs) {
+  string filter;
+  for (size_t i = 0; i < pairs; i++) {
+    if (i) filter += "|";
+    filter += "Format " + std::to_string(i) + " (*.f" + std::to_string(i) + ")|";
+    filter += (i % 2) ? "*.f" + std::to_string(i) + ";*.g" + std::to_string(i) + ";*.*" : "*.f" + std::to_string(i);
+  }
+  return filter;
+}
+
+// what a multiple selection file chooser prints
+string selection_text(size_t files) {
+  string selection;
+  for (size_t i = 0; i < files; i++) {
+    if (i) selection += "\n";
+    selection += "/home/user/Pictures/Holiday 2021/IMG_" + std::to_string(100000 + i) + ".png";
+  }
+  return selection;
+}
+
+void BM_string_replace_all(benchmark::State &state) {
+  string text = filter_text(3);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(string_replace_all(text, "*.*", "*"));
+}
+BENCHMARK(BM_string_replace_all);
+
+void BM_add_escaping_message(benchmark::State &state) {
+  string text = message_text(state.range(0));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(add_escaping(text, false, ""));
+  state.SetBytesProcessed(state.iterations() * text.length());
+  state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_add_escaping_message)->RangeMultiplier(16)->Range(64, 1 << 20)->Complexity();
+
+void BM_add_escaping_quotes(benchmark::State &state) {
+  string text(state.range(0), '"');
+  for (auto _ : state)
+    benchmark::DoNotOptimize(add_escaping(text, false, ""));
+  state.SetBytesProcessed(state.iterations() * text.length());
+  state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_add_escaping_quotes)->RangeMultiplier(16)->Range(64, 1 << 20)->Complexity();
+
+// accented text takes the path that checks each multi-byte sequence
+void BM_add_escaping_utf8(benchmark::State &state) {
+  string text;
+  while (text.length() < (size_t)state.range(0))
+    text += "D\xC3\xA9j\xC3\xA0 vu, \xE2\x82\xAC 5 ";
+  for (auto _ : state)
+    benchmark::DoNotOptimize(add_escaping(text, false, ""));
+  state.SetBytesProcessed(state.iterations() * text.length());
+  state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_add_escaping_utf8)->RangeMultiplier(16)->Range(64, 1 << 20)->Complexity();
+
+// Latin-1 bytes, every one of them replaced
+void BM_add_escaping_repair(benchmark::State &state) {
+  string text = message_text(state.range(0));
+  for (size_t i = 0; i < text.length(); i += 8)
+    text[i] = '\xE9';
+  utf8_repair.store(true);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(add_escaping(text, false, ""));
+  utf8_repair.store(false);
+  state.SetBytesProcessed(state.iterations() * text.length());
+}
+BENCHMARK(BM_add_escaping_repair)->Arg(1 << 20);
+
+// controls at every offset in a block, with quotes and accents between them;
+// the answer is checked against escaping one byte at a time first, which is
+// the scalar tail every wider scan has to agree with
+void BM_add_escaping_controls(benchmark::State &state) {
+  string text;
+  for (size_t i = 0; text.length() < (size_t)state.range(0); i++) {
+    text += message_text(i % 37);
+    text += (char)(i % 0x20);
+    if (i % 3 == 0) text += "\xC3\xA9";
+  }
+  string scalar;
+  bool invalid = false;
+  for (size_t i = 0; i < text.length();) {
+    size_t written = 0;
+    char out[4];
+    size_t taken = text_put<true>(out, written, &text[i], text.data() + text.length(), true, true, false, invalid);
+    scalar.append(out, written);
+    i += taken;
+  }
+  if (add_escaping(text, false, "") != scalar) {
+    state.SkipWithError("add_escaping disagrees with the scalar path on control bytes");
+    return;
+  }
+  for (auto _ : state)
+    benchmark::DoNotOptimize(add_escaping(text, false, ""));
+  state.SetBytesProcessed(state.iterations() * text.length());
+}
+BENCHMARK(BM_add_escaping_controls)->Arg(1 << 16);
+
+void BM_add_escaping_caption(benchmark::State &state) {
+  string caption = "";
+  for (auto _ : state)
+    benchmark::DoNotOptimize(add_escaping(caption, true, "Open"));
+}
+BENCHMARK(BM_add_escaping_caption);
+
+void BM_zenity_filter(benchmark::State &state) {
+  string filter = filter_text(state.range(0));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(zenity_filter(filter));
+  state.SetBytesProcessed(state.iterations() * filter.length());
+}
+BENCHMARK(BM_zenity_filter)->RangeMultiplier(8)->Range(1, 4096);
+
+void BM_kdialog_filter(benchmark::State &state) {
+  string filter = filter_text(state.range(0));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(kdialog_filter(filter));
+  state.SetBytesProcessed(state.iterations() * filter.length());
+}
+BENCHMARK(BM_kdialog_filter)->RangeMultiplier(8)->Range(1, 4096);
+
+void BM_string_split_selection(benchmark::State &state) {
+  string selection = selection_text(state.range(0));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(string_split(selection, '\n'));
+  state.SetBytesProcessed(state.iterations() * selection.length());
+}
+BENCHMARK(BM_string_split_selection)->Arg(1)->Arg(10)->Arg(1000);
+
+void BM_string_split_filter(benchmark::State &state) {
+  string filter = filter_text(3);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(string_split(filter, '|'));
+}
+BENCHMARK(BM_string_split_filter);
+
+void BM_remove_trailing_zeros(benchmark::State &state) {
+  const double values[] = { 0, 42, -7.5, 3.14159, 1e15 };
+  size_t i = 0;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(remove_trailing_zeros(values[i++ % 5]));
+}
+BENCHMARK(BM_remove_trailing_zeros);
+
+void BM_zenity_color(benchmark::State &state) {
+  string reply = state.range(0) ? "rgba(18,52,86,0.5)" : "rgb(18,52,86)";
+  for (auto _ : state)
+    benchmark::DoNotOptimize(zenity_color(reply, 0));
+}
+BENCHMARK(BM_zenity_color)->Arg(0)->Arg(1);
+
+void BM_kdialog_color(benchmark::State &state) {
+  string reply = "#123456";
+  for (auto _ : state)
+    benchmark::DoNotOptimize(kdialog_color(reply));
+}
+BENCHMARK(BM_kdialog_color);
+
+} // anonymous namespace
+
+BENCHMARK_MAIN();
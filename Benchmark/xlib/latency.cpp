@@ -0,0 +1,231 @@
+/*
+
+ MIT License
+
+ Copyright © 2021 Samuel Venable
+ Copyright © 2021 Robert B. Colton
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+*/
+
+// end-to-end latency of every blocking dialog function, run against the fake
+// zenity and kdialog from fake_engine.c on an X server with no window
+// manager, such as Xvfb. per call it reports, as percentiles:
+//   mapped     call start until the engine's window is mapped
+//   decorated  call start until the decorator has set the caption
+//   returned   engine printing its answer until the call returns
+// usage: latency [-n runs] [-d engine delay ms] [-e Zenity|KDialog]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+#include <time.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+#include "../../DlgModule/Universal/dlgmodule.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+struct sample {
+  double mapped;
+  double decorated;
+  double returned;
+};
+
+struct bench_case {
+  const char *name;
+  std::function<void()> call;
+};
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+double percentile(vector<double> values, double p) {
+  if (values.empty()) return NAN;
+  std::sort(values.begin(), values.end());
+  size_t index = (size_t)std::ceil(p * values.size()) - 1;
+  return values[std::min(index, values.size() - 1)];
+}
+
+string format_percentiles(const vector<double> &values) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%7.2f %7.2f %7.2f", percentile(values, 0.5),
+    percentile(values, 0.9), percentile(values, 0.99));
+  return buffer;
+}
+
+// the last record the fake engine appended since the previous call
+bool read_record(FILE *log, uint64_t record[4]) {
+  char line[256];
+  bool found = false;
+  clearerr(log);
+  while (fgets(line, sizeof(line), log)) {
+    unsigned long long start, mapped, decorated, answered;
+    if (sscanf(line, "%llu %llu %llu %llu", &start, &mapped, &decorated, &answered) == 4) {
+      record[0] = start; record[1] = mapped; record[2] = decorated; record[3] = answered;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// a window manager interns these at start-up; without one the decorator,
+// which only looks up existing atoms, would never find the dialog window.
+// also maps the window the dialogs are made transient for
+xcb_connection_t *prepare_display(xcb_window_t *owner) {
+  xcb_connection_t *connection = xcb_connect(nullptr, nullptr);
+  if (xcb_connection_has_error(connection)) return nullptr;
+  const char *names[] = { "_NET_ACTIVE_WINDOW", "_NET_WM_PID", "_NET_WM_NAME", "_NET_WM_ICON", "UTF8_STRING" };
+  for (const char *name : names)
+    free(xcb_intern_atom_reply(connection, xcb_intern_atom(connection, false, strlen(name), name), nullptr));
+  xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(connection)).data;
+  *owner = xcb_generate_id(connection);
+  xcb_create_window(connection, XCB_COPY_FROM_PARENT, *owner, screen->root, 0, 0, 640, 480, 0,
+    XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, nullptr);
+  xcb_map_window(connection, *owner);
+  free(xcb_get_input_focus_reply(connection, xcb_get_input_focus(connection), nullptr));
+  return connection;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  unsigned runs = 20;
+  double delay = 50;
+  vector<string> engines = { "Zenity", "KDialog" };
+  int option;
+  while ((option = getopt(argc, argv, "n:d:e:")) != -1) {
+    if (option == 'n') runs = (unsigned)atoi(optarg);
+    else if (option == 'd') delay = atof(optarg);
+    else if (option == 'e') engines = { optarg };
+    else {
+      fprintf(stderr, "usage: %s [-n runs] [-d engine delay ms] [-e Zenity|KDialog]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  xcb_window_t owner = 0;
+  xcb_connection_t *connection = prepare_display(&owner);
+  if (!connection) {
+    fprintf(stderr, "no X display; run this under Xvfb\n");
+    return 1;
+  }
+
+  char log_path[] = "/tmp/dlgmod-latency-XXXXXX";
+  char list_path[] = "/tmp/dlgmod-list-XXXXXX";
+  char text_path[] = "/tmp/dlgmod-text-XXXXXX";
+  int log_fd = mkstemp(log_path), list_fd = mkstemp(list_path), text_fd = mkstemp(text_path);
+  if (log_fd == -1 || list_fd == -1 || text_fd == -1) return 1;
+  FILE *list = fdopen(list_fd, "w");
+  for (unsigned i = 0; i < 1000; i++) fprintf(list, "row %u\n", i);
+  fclose(list);
+  FILE *text = fdopen(text_fd, "w");
+  for (unsigned i = 0; i < 4096; i++) fputs("the quick brown fox jumps over the lazy dog\n", text);
+  fclose(text);
+  FILE *log = fdopen(log_fd, "r");
+
+  char delay_str[32];
+  snprintf(delay_str, sizeof(delay_str), "%g", delay);
+  setenv("DLGMOD_FAKE_DELAY", delay_str, 1);
+  setenv("DLGMOD_FAKE_LOG", log_path, 1);
+  string owner_str = std::to_string(owner);
+  dialog_module::widget_set_owner((char *)owner_str.c_str());
+  dialog_module::widget_set_caption((char *)"Latency");
+
+  using namespace dialog_module;
+  int prepared = -1;
+  vector<bench_case> cases = {
+    { "show_message", []() { show_message((char *)"benchmark"); } },
+    { "show_message_cancelable", []() { show_message_cancelable((char *)"benchmark"); } },
+    { "show_question", []() { show_question((char *)"benchmark"); } },
+    { "show_question_cancelable", []() { show_question_cancelable((char *)"benchmark"); } },
+    { "show_attempt", []() { show_attempt((char *)"benchmark"); } },
+    { "show_error", []() { show_error((char *)"benchmark", false); } },
+    { "show_text_file", [&text_path]() { show_text_file(text_path); } },
+    { "get_string", []() { get_string((char *)"benchmark", (char *)"default"); } },
+    { "get_password", []() { get_password((char *)"benchmark", (char *)"default"); } },
+    { "get_integer", []() { get_integer((char *)"benchmark", 7); } },
+    { "get_passcode", []() { get_passcode((char *)"benchmark", 7); } },
+    { "get_form", []() { get_form((char *)"benchmark", (char *)"Name|text|Age|integer"); } },
+    { "get_list_file", [&list_path]() { get_list_file((char *)"benchmark", (char *)"Rows", list_path); } },
+    { "get_open_filename", []() { get_open_filename((char *)"Text|*.txt", (char *)""); } },
+    { "get_open_filename_ext", []() { get_open_filename_ext((char *)"Text|*.txt", (char *)"", (char *)"/tmp", (char *)"Open"); } },
+    { "get_open_filenames", []() { get_open_filenames((char *)"Text|*.txt", (char *)""); } },
+    { "get_open_filenames_ext", []() { get_open_filenames_ext((char *)"Text|*.txt", (char *)"", (char *)"/tmp", (char *)"Open"); } },
+    { "get_save_filename", []() { get_save_filename((char *)"Text|*.txt", (char *)"out.txt"); } },
+    { "get_save_filename_ext", []() { get_save_filename_ext((char *)"Text|*.txt", (char *)"out.txt", (char *)"/tmp", (char *)"Save"); } },
+    { "get_directory", []() { get_directory((char *)"/tmp"); } },
+    { "get_directory_alt", []() { get_directory_alt((char *)"Folder", (char *)"/tmp"); } },
+    { "get_color", []() { get_color(0xff); } },
+    { "get_color_ext", []() { get_color_ext(0xff, (char *)"Color"); } },
+    { "dialog_prepared_show", [&prepared]() { dialog_prepared_show(prepared, (char *)"benchmark"); } }
+  };
+
+  printf("%u runs per function, engine answers after %g ms; times in ms as p50 p90 p99\n\n", runs, delay);
+  printf("%-8s %-26s %-23s   %-23s   %-23s   %s\n", "engine", "function", "mapped", "decorated", "returned", "undecorated");
+  for (const string &engine : engines) {
+    widget_set_system((char *)engine.c_str());
+    if (prepared != -1) dialog_prepared_free(prepared);
+    prepared = dialog_prepare(DIALOG_MESSAGE, (char *)"Prepared", nullptr);
+    for (const bench_case &item : cases) {
+      vector<double> mapped, decorated, returned;
+      unsigned undecorated = 0;
+      for (unsigned i = 0; i < runs; i++) {
+        // skips whatever a previous run's late engine left behind
+        uint64_t record[4];
+        read_record(log, record);
+        uint64_t start = now_ns();
+        item.call();
+        uint64_t end = now_ns();
+        if (!read_record(log, record)) continue;
+        mapped.push_back((record[1] - start) / 1e6);
+        if (record[2]) decorated.push_back((record[2] - start) / 1e6);
+        else undecorated++;
+        returned.push_back((end - record[3]) / 1e6);
+      }
+      printf("%-8s %-26s %s   %s   %s   %u/%u\n", engine.c_str(), item.name, format_percentiles(mapped).c_str(),
+        format_percentiles(decorated).c_str(), format_percentiles(returned).c_str(), undecorated, runs);
+      fflush(stdout);
+    }
+  }
+
+  dialog_prepared_free(prepared);
+  fclose(log);
+  unlink(log_path);
+  unlink(list_path);
+  unlink(text_path);
+  xcb_disconnect(connection);
+  return 0;
+}
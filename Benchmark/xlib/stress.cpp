@@ -0,0 +1,323 @@
+/*
+
+ MIT License
+
+ Copyright © 2021 Samuel Venable
+ Copyright © 2021 Robert B. Colton
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+
+*/
+
+// drives tens of thousands of dialogs through the exported module API, the
+// way the runner calls it, against the fake engines from fake_engine.c, and
+// watches the process for leaks while it does. three phases run in turn:
+//   sequential  one dialog after another from the main thread
+//   concurrent  the same, from several threads at once
+//   async       batches of *_async calls, answered through the callbacks
+// every sample prints throughput since the last one and what the process
+// holds: open descriptors, live children, zombie children, threads, unix
+// sockets (X connections, also counting the decorators') and resident set.
+// the exit status is 1 if anything but the resident set is higher once the
+// run has settled than before it started
+// usage: stress [-n dialogs per phase] [-t threads] [-s sample every] [-d engine delay ms]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <string>
+
+#include <dirent.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+extern "C" {
+
+double show_message(char *str);
+double show_question(char *str);
+double show_text_file(char *fname);
+char *get_string(char *str, char *def);
+double get_integer(char *str, double def);
+char *get_list_file(char *str, char *column, char *fname);
+char *get_open_filename(char *filter, char *fname);
+char *get_save_filename(char *filter, char *fname);
+char *get_directory(char *dname);
+double get_color(double defcol);
+double show_message_async(char *str);
+double show_question_async(char *str);
+double show_text_file_async(char *fname);
+double get_string_async(char *str, char *def);
+double get_integer_async(char *str, double def);
+double get_list_file_async(char *str, char *column, char *fname);
+double get_open_filename_async(char *filter, char *fname);
+double get_save_filename_async(char *filter, char *fname);
+double get_directory_async(char *dname);
+double get_color_async(double defcol);
+double widget_set_system(char *sys);
+double widget_set_caption(char *str);
+double widget_set_max_dialogs(double count);
+void RegisterCallbacks(char *arg1, char *arg2, char *arg3, char *arg4);
+
+}
+
+namespace {
+
+struct usage {
+  unsigned fds;
+  unsigned children;
+  unsigned zombies;
+  unsigned threads;
+  unsigned sockets;
+  unsigned long rss_kb;
+};
+
+// the runner's side of the async callbacks, only counting what comes back
+std::mutex async_mutex;
+std::condition_variable async_answered;
+unsigned long async_done = 0;
+std::atomic<int> async_maps(0);
+
+void CreateAsynEventWithDSMap(int, int) {
+  std::lock_guard<std::mutex> lock(async_mutex);
+  async_done++;
+  async_answered.notify_all();
+}
+
+int CreateDsMap(int, ...) {
+  return ++async_maps;
+}
+
+bool DsMapAddDouble(int, char *, double) {
+  return true;
+}
+
+bool DsMapAddString(int, char *, char *) {
+  return true;
+}
+
+unsigned count_sockets(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+  DIR *dir = opendir(path);
+  if (!dir) return 0;
+  unsigned count = 0;
+  while (struct dirent *entry = readdir(dir)) {
+    char link[320], target[64];
+    snprintf(link, sizeof(link), "%s/%s", path, entry->d_name);
+    ssize_t length = readlink(link, target, sizeof(target) - 1);
+    if (length > 0 && strncmp(target, "socket:", 7) == 0) count++;
+  }
+  closedir(dir);
+  return count;
+}
+
+usage usage_sample() {
+  usage now = { 0, 0, 0, 0, 0, 0 };
+  if (DIR *dir = opendir("/proc/self/fd")) {
+    while (struct dirent *entry = readdir(dir))
+      if (entry->d_name[0] != '.') now.fds++;
+    closedir(dir);
+    now.fds--; // the one opendir() holds
+  }
+  now.sockets = count_sockets(getpid());
+  if (DIR *dir = opendir("/proc")) {
+    while (struct dirent *entry = readdir(dir)) {
+      if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+      char path[320], stat[512];
+      snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+      FILE *file = fopen(path, "r");
+      if (!file) continue;
+      size_t length = fread(stat, 1, sizeof(stat) - 1, file);
+      fclose(file);
+      stat[length] = '\0';
+      // the command name may hold spaces and parentheses, the fields after it cannot
+      char *fields = strrchr(stat, ')');
+      char state; int ppid;
+      if (!fields || sscanf(fields + 1, " %c %d", &state, &ppid) != 2 || ppid != getpid()) continue;
+      now.children++;
+      if (state == 'Z') now.zombies++;
+      else now.sockets += count_sockets(atoi(entry->d_name));
+    }
+    closedir(dir);
+  }
+  if (FILE *file = fopen("/proc/self/status", "r")) {
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+      sscanf(line, "Threads: %u", &now.threads);
+      sscanf(line, "VmRSS: %lu", &now.rss_kb);
+    }
+    fclose(file);
+  }
+  return now;
+}
+
+void usage_print(const char *phase, unsigned long done, double rate, const usage &now) {
+  printf("%-11s %8lu %10.1f %6u %9u %8u %8u %8u %10lu\n", phase, done, rate, now.fds, now.children,
+    now.zombies, now.threads, now.sockets, now.rss_kb);
+  fflush(stdout);
+}
+
+// dialogs and their async twins, taken in turn
+struct stress_case {
+  std::function<void()> call;
+  std::function<void()> call_async;
+};
+
+vector<stress_case> stress_cases(char *list_path, char *text_path) {
+  return {
+    { []() { show_message((char *)"stress"); }, []() { show_message_async((char *)"stress"); } },
+    { []() { show_question((char *)"stress"); }, []() { show_question_async((char *)"stress"); } },
+    { [text_path]() { show_text_file(text_path); }, [text_path]() { show_text_file_async(text_path); } },
+    { []() { get_string((char *)"stress", (char *)"default"); },
+      []() { get_string_async((char *)"stress", (char *)"default"); } },
+    { []() { get_integer((char *)"stress", 7); }, []() { get_integer_async((char *)"stress", 7); } },
+    { [list_path]() { get_list_file((char *)"stress", (char *)"Rows", list_path); },
+      [list_path]() { get_list_file_async((char *)"stress", (char *)"Rows", list_path); } },
+    { []() { get_open_filename((char *)"Text|*.txt", (char *)""); },
+      []() { get_open_filename_async((char *)"Text|*.txt", (char *)""); } },
+    { []() { get_save_filename((char *)"Text|*.txt", (char *)"out.txt"); },
+      []() { get_save_filename_async((char *)"Text|*.txt", (char *)"out.txt"); } },
+    { []() { get_directory((char *)"/tmp"); }, []() { get_directory_async((char *)"/tmp"); } },
+    { []() { get_color(0xff); }, []() { get_color_async(0xff); } }
+  };
+}
+
+double seconds_since(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+  unsigned long dialogs = 20000, sample = 1000;
+  unsigned threads = 8;
+  double delay = 0;
+  int option;
+  while ((option = getopt(argc, argv, "n:t:s:d:")) != -1) {
+    if (option == 'n') dialogs = strtoul(optarg, nullptr, 10);
+    else if (option == 't') threads = (unsigned)atoi(optarg);
+    else if (option == 's') sample = strtoul(optarg, nullptr, 10);
+    else if (option == 'd') delay = atof(optarg);
+    else {
+      fprintf(stderr, "usage: %s [-n dialogs per phase] [-t threads] [-s sample every] [-d engine delay ms]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (!threads) threads = 1;
+  if (!sample) sample = dialogs ? dialogs : 1;
+
+  char list_path[] = "/tmp/dlgmod-list-XXXXXX";
+  char text_path[] = "/tmp/dlgmod-text-XXXXXX";
+  int list_fd = mkstemp(list_path), text_fd = mkstemp(text_path);
+  if (list_fd == -1 || text_fd == -1) return 1;
+  FILE *list = fdopen(list_fd, "w");
+  for (unsigned i = 0; i < 100; i++) fprintf(list, "row %u\n", i);
+  fclose(list);
+  FILE *text = fdopen(text_fd, "w");
+  for (unsigned i = 0; i < 256; i++) fputs("the quick brown fox jumps over the lazy dog\n", text);
+  fclose(text);
+
+  char delay_str[32];
+  snprintf(delay_str, sizeof(delay_str), "%g", delay);
+  setenv("DLGMOD_FAKE_DELAY", delay_str, 1);
+  unsetenv("DLGMOD_FAKE_LOG");
+  RegisterCallbacks((char *)CreateAsynEventWithDSMap, (char *)CreateDsMap,
+    (char *)DsMapAddDouble, (char *)DsMapAddString);
+  widget_set_system((char *)"Zenity");
+  widget_set_caption((char *)"Stress");
+  widget_set_max_dialogs(threads);
+  vector<stress_case> cases = stress_cases(list_path, text_path);
+
+  // one dialog first, so whatever the module sets up once is in the baseline
+  cases[0].call();
+  usage baseline = usage_sample();
+  printf("%lu dialogs per phase, %u threads, engine answers after %g ms\n\n", dialogs, threads, delay);
+  printf("%-11s %8s %10s %6s %9s %8s %8s %8s %10s\n", "phase", "dialogs", "per second", "fds",
+    "children", "zombies", "threads", "sockets", "rss kb");
+  usage_print("baseline", 0, 0, baseline);
+
+  std::chrono::steady_clock::time_point mark = std::chrono::steady_clock::now();
+  for (unsigned long done = 0; done < dialogs;) {
+    cases[done % cases.size()].call();
+    if (++done % sample == 0 || done == dialogs) {
+      usage_print("sequential", done, (done % sample ? done % sample : sample) / seconds_since(mark), usage_sample());
+      mark = std::chrono::steady_clock::now();
+    }
+  }
+
+  std::atomic<unsigned long> next(0);
+  std::mutex print_mutex;
+  vector<std::thread> workers;
+  mark = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < threads; i++) {
+    workers.emplace_back([&]() {
+      unsigned long done;
+      while ((done = next++) < dialogs) {
+        cases[done % cases.size()].call();
+        if ((done + 1) % sample == 0 || done + 1 == dialogs) {
+          std::lock_guard<std::mutex> lock(print_mutex);
+          unsigned long batch = (done + 1) % sample ? (done + 1) % sample : sample;
+          usage_print("concurrent", done + 1, batch / seconds_since(mark), usage_sample());
+          mark = std::chrono::steady_clock::now();
+        }
+      }
+    });
+  }
+  for (std::thread &worker : workers) worker.join();
+
+  mark = std::chrono::steady_clock::now();
+  for (unsigned long done = 0; done < dialogs;) {
+    unsigned long batch = std::min(sample, dialogs - done);
+    for (unsigned long i = 0; i < batch; i++)
+      cases[(done + i) % cases.size()].call_async();
+    done += batch;
+    std::unique_lock<std::mutex> lock(async_mutex);
+    async_answered.wait(lock, [done]() { return async_done >= done; });
+    lock.unlock();
+    usage_print("async", done, batch / seconds_since(mark), usage_sample());
+    mark = std::chrono::steady_clock::now();
+  }
+
+  // detached threads and late decorators get a moment to finish
+  usage settled = usage_sample();
+  for (unsigned i = 0; i < 20 && (settled.threads > baseline.threads || settled.children > baseline.children); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    settled = usage_sample();
+  }
+  usage_print("settled", dialogs * 3, 0, settled);
+  unlink(list_path);
+  unlink(text_path);
+
+  bool leaked = settled.fds > baseline.fds || settled.children > baseline.children ||
+    settled.zombies > baseline.zombies || settled.threads > baseline.threads || settled.sockets > baseline.sockets;
+  printf("\n%s\n", leaked ? "LEAK: the process holds more than it did before the run" : "no leaks");
+  return leaked ? 1 : 0;
+}
@@ -2,4 +2,5 @@ cd "${0%/*}"
 
 mkdir "DlgModule (x86)"
 mkdir "DlgModule (x86)/FreeBSD"
-clang++ "DlgModule/Universal/dlgmodule.cpp" "DlgModule/xlib/dlgmodule.cpp" "DlgModule/xlib/lodepng.cpp" -o "DlgModule (x86)/FreeBSD/libdlgmod.so" -std=c++17 -shared -lX11 -lutil -lc -lpthread -fPIC -m32
+clang++ "DlgModule/Universal/dlgmodule.cpp" "DlgModule/xlib/dlgmodule.cpp" "DlgModule/xlib/lodepng.cpp" -o "DlgModule (x86)/FreeBSD/libdlgmod.so" -std=c++17 -shared -lutil -lc -lpthread -fPIC -m32
+clang++ "DlgModule/xlib/dlgmodd.cpp" "DlgModule/xlib/dlgmodule.cpp" "DlgModule/xlib/lodepng.cpp" -o "DlgModule (x86)/FreeBSD/dlgmodd" -std=c++17 -lutil -lc -lpthread -m32
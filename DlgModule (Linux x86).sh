@@ -2,4 +2,5 @@ cd "${0%/*}"
 
 mkdir "DlgModule (x86)"
 mkdir "DlgModule (x86)/Linux"
-g++ "DlgModule/Universal/dlgmodule.cpp" "DlgModule/xlib/dlgmodule.cpp" "DlgModule/xlib/lodepng.cpp" -o "DlgModule (x86)/Linux/libdlgmod.so" -std=c++17 -shared -static-libgcc -static-libstdc++ -lX11 -lprocps -lpthread -fPIC -m32
+g++ "DlgModule/Universal/dlgmodule.cpp" "DlgModule/xlib/dlgmodule.cpp" "DlgModule/xlib/lodepng.cpp" -o "DlgModule (x86)/Linux/libdlgmod.so" -std=c++17 -shared -static-libgcc -static-libstdc++ -lpthread -ldl -fPIC -m32
+g++ "DlgModule/xlib/dlgmodd.cpp" "DlgModule/xlib/dlgmodule.cpp" "DlgModule/xlib/lodepng.cpp" -o "DlgModule (x86)/Linux/dlgmodd" -std=c++17 -static-libgcc -static-libstdc++ -lpthread -ldl -m32
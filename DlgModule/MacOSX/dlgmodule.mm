@@ -31,6 +31,8 @@
 
 #include <fstream>
 #include <string>
+#include <vector>
+#include <map>
 
 #include "../Universal/dlgmodule.h"
 #include "config.h"
@@ -793,6 +795,27 @@ namespace dialog_module {
 
     int const btn_array_len = 7;
     string btn_array[btn_array_len] = { "Abort", "Ignore", "OK", "Cancel", "Yes", "No", "Retry" };
+
+    // saved widget settings
+    struct widget_settings {
+      string owner;
+      string caption;
+      string icon;
+      string btn_array[btn_array_len];
+    };
+
+    std::map<int, widget_settings> settings_saved;
+    int settings_saved_id = 0;
+
+    // prepared dialogs
+    struct prepared_dialog {
+      int type;
+      string title;
+      string filter;
+    };
+
+    std::map<int, prepared_dialog> prepared_dialogs;
+    int prepared_id = 0;
     
     string remove_trailing_zeros(double numb) {
       string strnumb = std::to_string(numb);
@@ -849,6 +872,18 @@ namespace dialog_module {
     if (result == 1) exit(0);
     return result;
   }
+
+  // no native text viewer on this platform yet
+  int show_text_fd(int fd) {
+    return 0;
+  }
+
+  int show_text_file(char *fname) {
+    return 0;
+  }
+
+  // no notification support on this platform yet, so they are dropped
+  void notify(char *str) { }
   
   char *get_string(char *str, char *def) {
     string str_str = str;
@@ -895,6 +930,48 @@ namespace dialog_module {
 
     return result;
   }
+
+  char *get_form(char *str, char *fields) {
+    // no native form, so ask for each "Label|type" pair in turn
+    std::vector<string> stringVec;
+    string str_fields = fields;
+    size_t pos = 0, next;
+    while ((next = str_fields.find('|', pos)) != string::npos) {
+      stringVec.push_back(str_fields.substr(pos, next - pos));
+      pos = next + 1;
+    }
+    stringVec.push_back(str_fields.substr(pos));
+
+    static string result; result = "";
+    for (size_t i = 0; i < stringVec.size(); i += 2) {
+      string label = stringVec[i];
+      string type = (i + 1 < stringVec.size()) ? stringVec[i + 1] : "text";
+      string prompt = (i == 0 && string(str) != "") ? string(str) + "\n\n" + label : label;
+      string value;
+      if (type == "password") {
+        value = get_password((char *)prompt.c_str(), (char *)"");
+      } else if (type == "integer") {
+        value = remove_trailing_zeros(get_integer((char *)prompt.c_str(), 0));
+      } else if (type.compare(0, 6, "combo:") == 0) {
+        string values = type.substr(6);
+        prompt += string(" (") + [[[NSString stringWithUTF8String:values.c_str()] stringByReplacingOccurrencesOfString:@";" withString:@", "] UTF8String] + ")";
+        value = get_string((char *)prompt.c_str(), (char *)values.substr(0, values.find(';')).c_str());
+      } else {
+        value = get_string((char *)prompt.c_str(), (char *)"");
+      }
+      result += (i ? "\n" : "") + value;
+    }
+    return (char *)result.c_str();
+  }
+
+  // no native list dialog on this platform yet
+  char *get_list(char *str, char *column, list_next_t next, void *data) {
+    return (char *)"";
+  }
+
+  char *get_list_file(char *str, char *column, char *fname) {
+    return get_list(str, column, NULL, NULL);
+  }
   
   char *get_open_filename(char *filter, char *fname) {
     string str_filter = filter; string str_fname = fname; static string result;
@@ -1027,5 +1104,156 @@ namespace dialog_module {
     }
     return (char *)btn_array[(int)type].c_str();
   }
+
+  // dialogs are native here, there is no daemon to hand them to
+  int widget_get_daemon() {
+    return 0;
+  }
+
+  void widget_set_daemon(int enable) { }
+
+  // the traced phases belong to the zenity and kdialog engines; the dump
+  // still writes a valid trace here, it is just empty
+  int widget_get_tracing() {
+    return 0;
+  }
+
+  void widget_set_tracing(int enable) { }
+
+  // only the xlib engines check and repair UTF-8 so far
+  int widget_get_utf8_repair() {
+    return 0;
+  }
+
+  void widget_set_utf8_repair(int enable) { }
+
+  // the counted sites are in the zenity and kdialog code paths
+  int widget_get_counters() {
+    return 0;
+  }
+
+  void widget_set_counters(int enable) { }
+
+  int dialog_trace_dump(char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) return 0;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[]}\n", file);
+    return (fclose(file) == 0);
+  }
+
+  // the "Mock" system is only there for the zenity and kdialog builds
+  void dialog_mock_push(char *answer, double delay) { }
+
+  int dialog_mock_load(char *fname) {
+    return 0;
+  }
+
+  void dialog_mock_clear() { }
+
+  // only the zenity and kdialog engines keep metrics so far
+  char *dialog_metrics_snapshot() {
+    return (char *)"{}";
+  }
+
+  char *dialog_counters_snapshot() {
+    return (char *)"{}";
+  }
+
+  int widget_save_settings() {
+    widget_settings saved;
+    saved.owner = cocoa_widget_get_owner() ? cocoa_widget_get_owner() : "";
+    saved.caption = caption;
+    saved.icon = current_icon;
+    for (int i = 0; i < btn_array_len; i++)
+      saved.btn_array[i] = widget_get_button_name(i);
+    settings_saved[settings_saved_id] = saved;
+    return settings_saved_id++;
+  }
+
+  void widget_restore_settings(int id) {
+    std::map<int, widget_settings>::iterator saved = settings_saved.find(id);
+    if (saved == settings_saved.end()) return;
+    static string owner;
+    owner = saved->second.owner;
+    cocoa_widget_set_owner((char *)owner.c_str());
+    caption = saved->second.caption;
+    current_icon = saved->second.icon;
+    for (int i = 0; i < btn_array_len; i++)
+      widget_set_button_name(i, (char *)saved->second.btn_array[i].c_str());
+  }
+
+  void widget_free_settings(int id) {
+    settings_saved.erase(id);
+  }
+
+  // the settings here are plain globals that every thread shares, so a
+  // queued dialog still shows with whatever is set when it starts
+  void widget_use_settings(int id) { }
+
+  int dialog_prepare(int type, char *title, char *filter) {
+    if (type < DIALOG_MESSAGE || type > DIALOG_DIRECTORY) return -1;
+    prepared_dialog prepared;
+    prepared.type = type;
+    prepared.title = title ? title : "";
+    prepared.filter = filter ? filter : "";
+    prepared_dialogs[prepared_id] = prepared;
+    return prepared_id++;
+  }
+
+  int dialog_prepared_show(int id, char *str) {
+    std::map<int, prepared_dialog>::iterator found = prepared_dialogs.find(id);
+    if (found == prepared_dialogs.end()) return 0;
+    string caption_previous = caption;
+    if (found->second.title != "") caption = found->second.title;
+    int result = 0;
+    switch (found->second.type) {
+      case DIALOG_MESSAGE:             result = show_message(str); break;
+      case DIALOG_MESSAGE_CANCELABLE:  result = show_message_cancelable(str); break;
+      case DIALOG_QUESTION:            result = show_question(str); break;
+      case DIALOG_QUESTION_CANCELABLE: result = show_question_cancelable(str); break;
+      case DIALOG_ATTEMPT:             result = show_attempt(str); break;
+      case DIALOG_ERROR:               result = show_error(str, false); break;
+      case DIALOG_ERROR_ABORT:         result = show_error(str, true); break;
+    }
+    caption = caption_previous;
+    return result;
+  }
+
+  char *dialog_prepared_get(int id, char *str) {
+    std::map<int, prepared_dialog>::iterator found = prepared_dialogs.find(id);
+    if (found == prepared_dialogs.end()) return (char *)"";
+    char *filter = (char *)found->second.filter.c_str();
+    char *title = (char *)found->second.title.c_str();
+    switch (found->second.type) {
+      case DIALOG_OPEN_FILENAME:  return get_open_filename_ext(filter, str, (char *)"", title);
+      case DIALOG_OPEN_FILENAMES: return get_open_filenames_ext(filter, str, (char *)"", title);
+      case DIALOG_SAVE_FILENAME:  return get_save_filename_ext(filter, str, (char *)"", title);
+      case DIALOG_DIRECTORY:      return get_directory_alt(title, str);
+    }
+    string caption_previous = caption;
+    if (found->second.title != "") caption = found->second.title;
+    char *result = (char *)"";
+    if (found->second.type == DIALOG_GET_STRING) result = get_string(str, (char *)"");
+    if (found->second.type == DIALOG_GET_PASSWORD) result = get_password(str, (char *)"");
+    caption = caption_previous;
+    return result;
+  }
+
+  void dialog_prepared_free(int id) {
+    prepared_dialogs.erase(id);
+  }
+
+  // no progress window on this platform yet; callers get an invalid id back
+  int progress_open(char *str) {
+    return -1;
+  }
+
+  int progress_update(int id, double value) {
+    return 0;
+  }
+
+  void progress_set_text(int id, char *str) { }
+
+  void progress_close(int id) { }
   
 } // namespace dialog_module
@@ -25,10 +25,30 @@
 */
 
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <memory>
 #include <string>
+#include <tuple>
+#include <map>
+#include <vector>
 
 #include "dlgmodule.h"
 
+// the async queue's USDT probes, under the same dlgmod provider as the
+// dialog probes in the xlib build
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define DLGMOD_PROBE2(name, arg1, arg2) DTRACE_PROBE2(dlgmod, name, arg1, arg2)
+#endif
+#endif
+#ifndef DLGMOD_PROBE2
+#define DLGMOD_PROBE2(name, arg1, arg2) do { } while (0)
+#endif
+
 #ifdef _WIN32
 #define EXPORTED_FUNCTION extern "C" __declspec(dllexport)
 #else /* macOS, Linux, and BSD */
@@ -47,6 +67,9 @@ EXPORTED_FUNCTION double show_attempt(char *str);
 EXPORTED_FUNCTION double show_attempt_async(char *str);
 EXPORTED_FUNCTION double show_error(char *str, double abort);
 EXPORTED_FUNCTION double show_error_async(char *str, double abort);
+EXPORTED_FUNCTION double show_text_file(char *fname);
+EXPORTED_FUNCTION double show_text_file_async(char *fname);
+EXPORTED_FUNCTION double notify(char *str);
 EXPORTED_FUNCTION char *get_string(char *str, char *def);
 EXPORTED_FUNCTION double get_string_async(char *str, char *def);
 EXPORTED_FUNCTION char *get_password(char *str, char *def);
@@ -55,6 +78,10 @@ EXPORTED_FUNCTION double get_integer(char *str, double def);
 EXPORTED_FUNCTION double get_integer_async(char *str, double def);
 EXPORTED_FUNCTION double get_passcode(char *str, double def);
 EXPORTED_FUNCTION double get_passcode_async(char *str, double def);
+EXPORTED_FUNCTION char *get_form(char *str, char *fields);
+EXPORTED_FUNCTION double get_form_async(char *str, char *fields);
+EXPORTED_FUNCTION char *get_list_file(char *str, char *column, char *fname);
+EXPORTED_FUNCTION double get_list_file_async(char *str, char *column, char *fname);
 EXPORTED_FUNCTION char *get_open_filename(char *filter, char *fname);
 EXPORTED_FUNCTION double get_open_filename_async(char *filter, char *fname);
 EXPORTED_FUNCTION char *get_open_filename_ext(char *filter, char *fname, char *dir, char *title);
@@ -85,312 +112,508 @@ EXPORTED_FUNCTION char *widget_get_system();
 EXPORTED_FUNCTION double widget_set_system(char *sys);
 EXPORTED_FUNCTION char *widget_get_button_name(double type);
 EXPORTED_FUNCTION double widget_set_button_name(double type, char *name);
+EXPORTED_FUNCTION double widget_get_dedup_window();
+EXPORTED_FUNCTION double widget_set_dedup_window(double ms);
+EXPORTED_FUNCTION double widget_get_priority();
+EXPORTED_FUNCTION double widget_set_priority(double priority);
+EXPORTED_FUNCTION double widget_get_max_dialogs();
+EXPORTED_FUNCTION double widget_set_max_dialogs(double count);
+EXPORTED_FUNCTION double dialog_queue_depth();
+EXPORTED_FUNCTION double dialog_queue_running();
+EXPORTED_FUNCTION double dialog_queue_wait_average();
+EXPORTED_FUNCTION double dialog_queue_wait_max();
+EXPORTED_FUNCTION double widget_get_daemon();
+EXPORTED_FUNCTION double widget_set_daemon(double enable);
+EXPORTED_FUNCTION double widget_get_tracing();
+EXPORTED_FUNCTION double widget_set_tracing(double enable);
+EXPORTED_FUNCTION double widget_get_utf8_repair();
+EXPORTED_FUNCTION double widget_set_utf8_repair(double enable);
+EXPORTED_FUNCTION double widget_get_counters();
+EXPORTED_FUNCTION double widget_set_counters(double enable);
+EXPORTED_FUNCTION double dialog_trace_dump(char *path);
+EXPORTED_FUNCTION double dialog_mock_push(char *answer, double delay);
+EXPORTED_FUNCTION double dialog_mock_load(char *fname);
+EXPORTED_FUNCTION double dialog_mock_clear();
+EXPORTED_FUNCTION char *dialog_metrics_snapshot();
+EXPORTED_FUNCTION char *dialog_counters_snapshot();
+EXPORTED_FUNCTION double widget_save_settings();
+EXPORTED_FUNCTION double widget_restore_settings(double id);
+EXPORTED_FUNCTION double widget_free_settings(double id);
+EXPORTED_FUNCTION double dialog_prepare(double type, char *title, char *filter);
+EXPORTED_FUNCTION double dialog_prepared_show(double id, char *str);
+EXPORTED_FUNCTION char *dialog_prepared_get(double id, char *str);
+EXPORTED_FUNCTION double dialog_prepared_free(double id);
+EXPORTED_FUNCTION double progress_open(char *str);
+EXPORTED_FUNCTION double progress_update(double id, double value);
+EXPORTED_FUNCTION double progress_set_text(double id, char *str);
+EXPORTED_FUNCTION double progress_close(double id);
 EXPORTED_FUNCTION void RegisterCallbacks(char *arg1, char *arg2, char *arg3, char *arg4);
 
 namespace {
 
-unsigned dialog_identifier = 100;
-bool enable_dialog_creation = true;
 void(*CreateAsynEventWithDSMap)(int, int);
 int(*CreateDsMap)(int _num, ...);
 bool(*DsMapAddDouble)(int _index, char *_pKey, double value);
 bool(*DsMapAddString)(int _index, char *_pKey, char *pVal);
+// the runtime does not promise these are safe to call from several
+// threads at once, and with scheduler_max above one they would be
+std::mutex async_event_mutex;
+
+// storm protection: a show_* call that repeats one still on screen, or one
+// answered less than dedup_window ms ago, gets that answer back instead of
+// a dialog of its own. the key holds the whole text, so only the very same
+// message is ever folded into another; the next dialog to show, whatever
+// its text, says how many were folded into ones already closed
+struct dedup_entry {
+  bool open = true;
+  int answer = 0;
+  unsigned repeats = 0;
+  std::chrono::steady_clock::time_point closed;
+};
+
+typedef std::tuple<int, std::string, std::string> dedup_key;
+std::mutex dedup_mutex;
+std::condition_variable dedup_closed;
+std::map<dedup_key, std::shared_ptr<dedup_entry>> dedup_entries;
+double dedup_window = 0;
+
+int dedup_show(int type, char *str, std::function<int(char *)> show) {
+  std::unique_lock<std::mutex> lock(dedup_mutex);
+  if (dedup_window <= 0) {
+    lock.unlock();
+    return show(str);
+  }
+  std::chrono::duration<double, std::milli> window(dedup_window);
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::string str_text = str ? str : "";
+  dedup_key key(type, dialog_module::widget_get_caption(), str_text);
+  std::map<dedup_key, std::shared_ptr<dedup_entry>>::iterator found = dedup_entries.find(key);
+  if (found != dedup_entries.end()) {
+    std::shared_ptr<dedup_entry> entry = found->second;
+    if (entry->open || now - entry->closed < window) {
+      entry->repeats++;
+      dedup_closed.wait(lock, [&entry] { return !entry->open; });
+      return entry->answer;
+    }
+  }
+  // collect the repeats of every closed dialog, and forget whatever has
+  // gone past its window while we are here
+  unsigned repeats = 0;
+  for (std::map<dedup_key, std::shared_ptr<dedup_entry>>::iterator it = dedup_entries.begin(); it != dedup_entries.end();) {
+    if (!it->second->open) {
+      repeats += it->second->repeats;
+      it->second->repeats = 0;
+    }
+    if (!it->second->open && now - it->second->closed >= window) it = dedup_entries.erase(it);
+    else it++;
+  }
+  std::shared_ptr<dedup_entry> entry = std::make_shared<dedup_entry>();
+  dedup_entries[key] = entry;
+  lock.unlock();
+  if (repeats) str_text += "\n\n(" + std::to_string(repeats) + " repeated dialogs were not shown)";
+  int answer = show((char *)str_text.c_str());
+  lock.lock();
+  entry->answer = answer;
+  entry->open = false;
+  entry->closed = std::chrono::steady_clock::now();
+  dedup_closed.notify_all();
+  return answer;
+}
+
+// async dialogs wait in a queue and start in priority order, first come
+// first served among equals, with at most one per owner window and no more
+// than scheduler_max on screen at once. each one runs with the settings
+// saved when it was queued, so it shows with the caption, owner and icon
+// it was asked for, and under the owner it was scheduled by
+struct scheduled_dialog {
+  unsigned id;
+  double priority;
+  int settings;
+  std::string owner;
+  std::chrono::steady_clock::time_point queued;
+  std::function<void(unsigned)> run;
+};
+
+std::mutex scheduler_mutex;
+std::vector<scheduled_dialog> scheduler_queue;
+std::map<std::string, unsigned> scheduler_owners;
+unsigned dialog_identifier = 100;
+unsigned scheduler_running = 0;
+// Windows and macOS keep their settings in globals every thread shares, so
+// widget_use_settings() has nothing to switch there, and dialogs running
+// side by side would show with and swap each other's; they take turns
+#if defined(_WIN32) || defined(__APPLE__)
+unsigned scheduler_max = 1;
+#else
+unsigned scheduler_max = 4;
+#endif
+double scheduler_priority = 0;
+// stats
+unsigned scheduler_started = 0;
+double scheduler_wait_total = 0;
+double scheduler_wait_max = 0;
+
+void scheduler_dispatch();
+
+void scheduler_run(scheduled_dialog dialog) {
+  dialog_module::widget_use_settings(dialog.settings);
+  dialog.run(dialog.id);
+  dialog_module::widget_use_settings(-1);
+  dialog_module::widget_free_settings(dialog.settings);
+  DLGMOD_PROBE2(async__complete, dialog.id, dialog.owner.c_str());
+  std::lock_guard<std::mutex> lock(scheduler_mutex);
+  scheduler_running--;
+  scheduler_owners.erase(dialog.owner);
+  scheduler_dispatch();
+}
+
+// expects scheduler_mutex to be held
+void scheduler_dispatch() {
+  while (scheduler_running < scheduler_max) {
+    std::vector<scheduled_dialog>::iterator next = scheduler_queue.end();
+    for (std::vector<scheduled_dialog>::iterator it = scheduler_queue.begin(); it != scheduler_queue.end(); it++) {
+      if (scheduler_owners.count(it->owner)) continue;
+      if (next == scheduler_queue.end() || it->priority > next->priority) next = it;
+    }
+    if (next == scheduler_queue.end()) return;
+    scheduled_dialog dialog = *next;
+    scheduler_queue.erase(next);
+    double wait = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - dialog.queued).count();
+    scheduler_wait_total += wait;
+    if (wait > scheduler_wait_max) scheduler_wait_max = wait;
+    scheduler_started++;
+    scheduler_running++;
+    scheduler_owners[dialog.owner] = dialog.id;
+    std::thread dialog_thread(scheduler_run, dialog);
+    dialog_thread.detach();
+  }
+}
 
-std::string arg1;
-std::string arg2;
-std::string arg3;
-std::string arg4;
+double dialog_schedule(std::function<void(unsigned)> run) {
+  int settings = dialog_module::widget_save_settings();
+  dialog_module::widget_use_settings(settings);
+  std::string owner = dialog_module::widget_get_owner();
+  dialog_module::widget_use_settings(-1);
+  std::lock_guard<std::mutex> lock(scheduler_mutex);
+  scheduled_dialog dialog;
+  dialog.id = dialog_identifier++;
+  dialog.priority = scheduler_priority;
+  dialog.settings = settings;
+  dialog.owner = owner;
+  dialog.queued = std::chrono::steady_clock::now();
+  dialog.run = run;
+  scheduler_queue.push_back(dialog);
+  DLGMOD_PROBE2(async__enqueue, dialog.id, dialog.owner.c_str());
+  scheduler_dispatch();
+  return (double)dialog.id;
+}
 
 void show_message_threaded(char *str, unsigned id) {
   double result = show_message(str);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void show_message_cancelable_threaded(char *str, unsigned id) {
   double result = show_message_cancelable(str);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void show_question_threaded(char *str, unsigned id) {
   double result = show_question(str);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void show_question_cancelable_threaded(char *str, unsigned id) {
   double result = show_question_cancelable(str);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void show_attempt_threaded(char *str, unsigned id) {
   double result = show_attempt(str);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void show_error_threaded(char *str, double abort, unsigned id) {
   double result = show_error(str, abort);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
+  int resultMap = CreateDsMap(0);
+  DsMapAddDouble(resultMap, (char *)"id", id);
+  DsMapAddDouble(resultMap, (char *)"status", result);
+  CreateAsynEventWithDSMap(resultMap, 63);
+}
+
+void show_text_file_threaded(char *fname, unsigned id) {
+  double result = show_text_file(fname);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_string_threaded(char *str, char *def, unsigned id) {
   char *result = get_string(str, def);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddString(resultMap, (char *)"result", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_password_threaded(char *str, char *def, unsigned id) {
   char *result = get_password(str, def);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddString(resultMap, (char *)"result", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_integer_threaded(char *str, double def, unsigned id) {
   double result = get_integer(str, def);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddDouble(resultMap, (char *)"value", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_passcode_threaded(char *str, double def, unsigned id) {
   double result = get_passcode(str, def);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddDouble(resultMap, (char *)"value", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
+}
+
+void get_form_threaded(char *str, char *fields, unsigned id) {
+  char *result = get_form(str, fields);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
+  int resultMap = CreateDsMap(0);
+  DsMapAddDouble(resultMap, (char *)"id", id);
+  DsMapAddDouble(resultMap, (char *)"status", 1);
+  DsMapAddString(resultMap, (char *)"result", result);
+  CreateAsynEventWithDSMap(resultMap, 63);
+}
+
+void get_list_file_threaded(char *str, char *column, char *fname, unsigned id) {
+  char *result = get_list_file(str, column, fname);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
+  int resultMap = CreateDsMap(0);
+  DsMapAddDouble(resultMap, (char *)"id", id);
+  DsMapAddDouble(resultMap, (char *)"status", 1);
+  DsMapAddString(resultMap, (char *)"result", result);
+  CreateAsynEventWithDSMap(resultMap, 63);
 }
 
 void get_open_filename_threaded(char *filter, char *fname, unsigned id) {
   char *result = get_open_filename(filter, fname);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddString(resultMap, (char *)"result", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_open_filename_ext_threaded(char *filter, char *fname, char *dir, char *title, unsigned id) {
   char *result = get_open_filename_ext(filter, fname, dir, title);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddString(resultMap, (char *)"result", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_open_filenames_threaded(char *filter, char *fname, unsigned id) {
   char *result = get_open_filenames(filter, fname);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddString(resultMap, (char *)"result", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_open_filenames_ext_threaded(char *filter, char *fname, char *dir, char *title, unsigned id) {
   char *result = get_open_filenames_ext(filter, fname, dir, title);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddString(resultMap, (char *)"result", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_save_filename_threaded(char *filter, char *fname, unsigned id) {
   char *result = get_save_filename(filter, fname);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddString(resultMap, (char *)"result", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_save_filename_ext_threaded(char *filter, char *fname, char *dir, char *title, unsigned id) {
   char *result = get_save_filename_ext(filter, fname, dir, title);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddString(resultMap, (char *)"result", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_directory_threaded(char *dname, unsigned id) {
   char *result = get_directory(dname);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddString(resultMap, (char *)"result", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_directory_alt_threaded(char *capt, char *root, unsigned id) {
   char *result = get_directory_alt(capt, root);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddString(resultMap, (char *)"result", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_color_threaded(double defcol, unsigned id) {
   double result = get_color(defcol);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddDouble(resultMap, (char *)"value", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 void get_color_ext_threaded(double defcol, char *title, unsigned id) {
   double result = get_color_ext(defcol, title);
+  std::lock_guard<std::mutex> lock(async_event_mutex);
   int resultMap = CreateDsMap(0);
   DsMapAddDouble(resultMap, (char *)"id", id);
   DsMapAddDouble(resultMap, (char *)"status", 1);
   DsMapAddDouble(resultMap, (char *)"value", result);
   CreateAsynEventWithDSMap(resultMap, 63);
-  enable_dialog_creation = true;
 }
 
 } // anonymous namespace
 
 double show_message(char *str) {
-  return dialog_module::show_message(str);
+  return dedup_show(dialog_module::DIALOG_MESSAGE, str, dialog_module::show_message);
 }
 
 double show_message_async(char *str) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = str;
-    std::thread dialog_thread(show_message_threaded, (char *)arg1.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = str;
+  return dialog_schedule([=](unsigned id) {
+    show_message_threaded((char *)arg1.c_str(), id);
+  });
 }
 
 double show_message_cancelable(char *str) {
-  return dialog_module::show_message_cancelable(str);
+  return dedup_show(dialog_module::DIALOG_MESSAGE_CANCELABLE, str, dialog_module::show_message_cancelable);
 }
 
 double show_message_cancelable_async(char *str) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = str;
-    std::thread dialog_thread(show_message_cancelable_threaded, (char *)arg1.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = str;
+  return dialog_schedule([=](unsigned id) {
+    show_message_cancelable_threaded((char *)arg1.c_str(), id);
+  });
 }
 
 double show_question(char *str) {
-  return dialog_module::show_question(str);
+  return dedup_show(dialog_module::DIALOG_QUESTION, str, dialog_module::show_question);
 }
 
 double show_question_async(char *str) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = str;
-    std::thread dialog_thread(show_question_threaded, (char *)arg1.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = str;
+  return dialog_schedule([=](unsigned id) {
+    show_question_threaded((char *)arg1.c_str(), id);
+  });
 }
 
 double show_question_cancelable(char *str) {
-  return dialog_module::show_question_cancelable(str);
+  return dedup_show(dialog_module::DIALOG_QUESTION_CANCELABLE, str, dialog_module::show_question_cancelable);
 }
 
 double show_question_cancelable_async(char *str) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = str;
-    std::thread dialog_thread(show_question_cancelable_threaded, (char *)arg1.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = str;
+  return dialog_schedule([=](unsigned id) {
+    show_question_cancelable_threaded((char *)arg1.c_str(), id);
+  });
 }
 
 double show_attempt(char *str) {
-  return dialog_module::show_attempt(str);
+  return dedup_show(dialog_module::DIALOG_ATTEMPT, str, dialog_module::show_attempt);
 }
 
 double show_attempt_async(char *str) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = str;
-    std::thread dialog_thread(show_attempt_threaded, (char *)arg1.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = str;
+  return dialog_schedule([=](unsigned id) {
+    show_attempt_threaded((char *)arg1.c_str(), id);
+  });
 }
 
 double show_error(char *str, double abort) {
-  return dialog_module::show_error(str, abort);
+  return dedup_show(abort ? dialog_module::DIALOG_ERROR_ABORT : dialog_module::DIALOG_ERROR, str,
+    [abort](char *text) { return dialog_module::show_error(text, abort); });
 }
 
 double show_error_async(char *str, double abort) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = str;
-    std::thread dialog_thread(show_error_threaded, (char *)arg1.c_str(), abort, id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = str;
+  return dialog_schedule([=](unsigned id) {
+    show_error_threaded((char *)arg1.c_str(), abort, id);
+  });
+}
+
+double show_text_file(char *fname) {
+  return dialog_module::show_text_file(fname);
+}
+
+double show_text_file_async(char *fname) {
+  std::string arg1 = fname;
+  return dialog_schedule([=](unsigned id) {
+    show_text_file_threaded((char *)arg1.c_str(), id);
+  });
+}
+
+double notify(char *str) {
+  dialog_module::notify(str);
+  return 0;
 }
 
 char *get_string(char *str, char *def) {
@@ -398,16 +621,11 @@ char *get_string(char *str, char *def) {
 }
 
 double get_string_async(char *str, char *def) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = str;
-    arg2 = def;
-    std::thread dialog_thread(get_string_threaded, (char *)arg1.c_str(), (char *)arg2.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = str;
+  std::string arg2 = def;
+  return dialog_schedule([=](unsigned id) {
+    get_string_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), id);
+  });
 }
 
 char *get_password(char *str, char *def) {
@@ -415,16 +633,11 @@ char *get_password(char *str, char *def) {
 }
 
 double get_password_async(char *str, char *def) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = str;
-    arg2 = def;
-    std::thread dialog_thread(get_password_threaded, (char *)arg1.c_str(), (char *)arg2.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = str;
+  std::string arg2 = def;
+  return dialog_schedule([=](unsigned id) {
+    get_password_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), id);
+  });
 }
 
 double get_integer(char *str, double def) {
@@ -432,15 +645,10 @@ double get_integer(char *str, double def) {
 }
 
 double get_integer_async(char *str, double def) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = str;
-    std::thread dialog_thread(get_integer_threaded, (char *)arg1.c_str(), def, id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = str;
+  return dialog_schedule([=](unsigned id) {
+    get_integer_threaded((char *)arg1.c_str(), def, id);
+  });
 }
 
 double get_passcode(char *str, double def) {
@@ -448,15 +656,35 @@ double get_passcode(char *str, double def) {
 }
 
 double get_passcode_async(char *str, double def) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = str;
-    std::thread dialog_thread(get_passcode_threaded, (char *)arg1.c_str(), def, id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = str;
+  return dialog_schedule([=](unsigned id) {
+    get_passcode_threaded((char *)arg1.c_str(), def, id);
+  });
+}
+
+char *get_form(char *str, char *fields) {
+  return dialog_module::get_form(str, fields);
+}
+
+double get_form_async(char *str, char *fields) {
+  std::string arg1 = str;
+  std::string arg2 = fields;
+  return dialog_schedule([=](unsigned id) {
+    get_form_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), id);
+  });
+}
+
+char *get_list_file(char *str, char *column, char *fname) {
+  return dialog_module::get_list_file(str, column, fname);
+}
+
+double get_list_file_async(char *str, char *column, char *fname) {
+  std::string arg1 = str;
+  std::string arg2 = column;
+  std::string arg3 = fname;
+  return dialog_schedule([=](unsigned id) {
+    get_list_file_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), (char *)arg3.c_str(), id);
+  });
 }
 
 char *get_open_filename(char *filter, char *fname) {
@@ -464,16 +692,11 @@ char *get_open_filename(char *filter, char *fname) {
 }
 
 double get_open_filename_async(char *filter, char *fname) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = filter;
-    arg2 = fname;
-    std::thread dialog_thread(get_open_filename_threaded, (char *)arg1.c_str(), (char *)arg2.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = filter;
+  std::string arg2 = fname;
+  return dialog_schedule([=](unsigned id) {
+    get_open_filename_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), id);
+  });
 }
 
 char *get_open_filename_ext(char *filter, char *fname, char *dir, char *title) {
@@ -481,18 +704,13 @@ char *get_open_filename_ext(char *filter, char *fname, char *dir, char *title) {
 }
 
 double get_open_filename_ext_async(char *filter, char *fname, char *dir, char *title) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = filter;
-    arg2 = fname;
-    arg3 = dir;
-    arg4 = title;
-    std::thread dialog_thread(get_open_filename_ext_threaded, (char *)arg1.c_str(), (char *)arg2.c_str(), (char *)arg3.c_str(), (char *)arg4.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = filter;
+  std::string arg2 = fname;
+  std::string arg3 = dir;
+  std::string arg4 = title;
+  return dialog_schedule([=](unsigned id) {
+    get_open_filename_ext_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), (char *)arg3.c_str(), (char *)arg4.c_str(), id);
+  });
 }
 
 char *get_open_filenames(char *filter, char *fname) {
@@ -500,16 +718,11 @@ char *get_open_filenames(char *filter, char *fname) {
 }
 
 double get_open_filenames_async(char *filter, char *fname) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = filter;
-    arg2 = fname;
-    std::thread dialog_thread(get_open_filenames_threaded, (char *)arg1.c_str(), (char *)arg2.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = filter;
+  std::string arg2 = fname;
+  return dialog_schedule([=](unsigned id) {
+    get_open_filenames_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), id);
+  });
 }
 
 char *get_open_filenames_ext(char *filter, char *fname, char *dir, char *title) {
@@ -517,18 +730,13 @@ char *get_open_filenames_ext(char *filter, char *fname, char *dir, char *title)
 }
 
 double get_open_filenames_ext_async(char *filter, char *fname, char *dir, char *title) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = filter;
-    arg2 = fname;
-    arg3 = dir;
-    arg4 = title;
-    std::thread dialog_thread(get_open_filenames_ext_threaded, (char *)arg1.c_str(), (char *)arg2.c_str(), (char *)arg3.c_str(), (char *)arg4.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = filter;
+  std::string arg2 = fname;
+  std::string arg3 = dir;
+  std::string arg4 = title;
+  return dialog_schedule([=](unsigned id) {
+    get_open_filenames_ext_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), (char *)arg3.c_str(), (char *)arg4.c_str(), id);
+  });
 }
 
 char *get_save_filename(char *filter, char *fname) {
@@ -536,16 +744,11 @@ char *get_save_filename(char *filter, char *fname) {
 }
 
 double get_save_filename_async(char *filter, char *fname) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = filter;
-    arg2 = fname;
-    std::thread dialog_thread(get_save_filename_threaded, (char *)arg1.c_str(), (char *)arg2.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = filter;
+  std::string arg2 = fname;
+  return dialog_schedule([=](unsigned id) {
+    get_save_filename_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), id);
+  });
 }
 
 char *get_save_filename_ext(char *filter, char *fname, char *dir, char *title) {
@@ -553,18 +756,13 @@ char *get_save_filename_ext(char *filter, char *fname, char *dir, char *title) {
 }
 
 double get_save_filename_ext_async(char *filter, char *fname, char *dir, char *title) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = filter;
-    arg2 = fname;
-    arg3 = dir;
-    arg4 = title;
-    std::thread dialog_thread(get_save_filename_ext_threaded, (char *)arg1.c_str(), (char *)arg2.c_str(), (char *)arg3.c_str(), (char *)arg4.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = filter;
+  std::string arg2 = fname;
+  std::string arg3 = dir;
+  std::string arg4 = title;
+  return dialog_schedule([=](unsigned id) {
+    get_save_filename_ext_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), (char *)arg3.c_str(), (char *)arg4.c_str(), id);
+  });
 }
 
 char *get_directory(char *dname) {
@@ -572,15 +770,10 @@ char *get_directory(char *dname) {
 }
 
 double get_directory_async(char *dname) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = dname;
-    std::thread dialog_thread(get_directory_threaded, (char *)arg1.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = dname;
+  return dialog_schedule([=](unsigned id) {
+    get_directory_threaded((char *)arg1.c_str(), id);
+  });
 }
 
 char *get_directory_alt(char *capt, char *root) {
@@ -588,16 +781,11 @@ char *get_directory_alt(char *capt, char *root) {
 }
 
 double get_directory_alt_async(char *capt, char *root) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg1 = capt;
-    arg2 = root;
-    std::thread dialog_thread(get_directory_alt_threaded, (char *)arg1.c_str(), (char *)arg2.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg1 = capt;
+  std::string arg2 = root;
+  return dialog_schedule([=](unsigned id) {
+    get_directory_alt_threaded((char *)arg1.c_str(), (char *)arg2.c_str(), id);
+  });
 }
 
 double get_color(double defcol) {
@@ -605,14 +793,9 @@ double get_color(double defcol) {
 }
 
 double get_color_async(double defcol) {
-  if (enable_dialog_creation) {
-	enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    std::thread dialog_thread(get_color_threaded, (int)defcol, id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  return dialog_schedule([=](unsigned id) {
+    get_color_threaded((int)defcol, id);
+  });
 }
 
 double get_color_ext(double defcol, char *title) {
@@ -620,15 +803,10 @@ double get_color_ext(double defcol, char *title) {
 }
 
 double get_color_ext_async(double defcol, char *title) {
-  if (enable_dialog_creation) {
-    enable_dialog_creation = false;
-    unsigned id = dialog_identifier++;
-    arg2 = title;
-    std::thread dialog_thread(get_color_ext_threaded, (int)defcol, (char *)arg2.c_str(), id);
-    dialog_thread.detach();
-    return (double)id;
-  }
-  return dialog_identifier - 1;
+  std::string arg2 = title;
+  return dialog_schedule([=](unsigned id) {
+    get_color_ext_threaded((int)defcol, (char *)arg2.c_str(), id);
+  });
 }
 
 char *widget_get_caption() {
@@ -676,6 +854,171 @@ double widget_set_button_name(double type, char *name) {
   return 0;
 }
 
+double widget_get_dedup_window() {
+  std::lock_guard<std::mutex> lock(dedup_mutex);
+  return dedup_window;
+}
+
+double widget_set_dedup_window(double ms) {
+  std::lock_guard<std::mutex> lock(dedup_mutex);
+  dedup_window = ms;
+  return 0;
+}
+
+double widget_get_priority() {
+  std::lock_guard<std::mutex> lock(scheduler_mutex);
+  return scheduler_priority;
+}
+
+double widget_set_priority(double priority) {
+  std::lock_guard<std::mutex> lock(scheduler_mutex);
+  scheduler_priority = priority;
+  return 0;
+}
+
+double widget_get_max_dialogs() {
+  std::lock_guard<std::mutex> lock(scheduler_mutex);
+  return scheduler_max;
+}
+
+double widget_set_max_dialogs(double count) {
+  std::lock_guard<std::mutex> lock(scheduler_mutex);
+  scheduler_max = (count < 1) ? 1 : (unsigned)count;
+  scheduler_dispatch();
+  return 0;
+}
+
+double dialog_queue_depth() {
+  std::lock_guard<std::mutex> lock(scheduler_mutex);
+  return scheduler_queue.size();
+}
+
+double dialog_queue_running() {
+  std::lock_guard<std::mutex> lock(scheduler_mutex);
+  return scheduler_running;
+}
+
+double dialog_queue_wait_average() {
+  std::lock_guard<std::mutex> lock(scheduler_mutex);
+  return scheduler_started ? scheduler_wait_total / scheduler_started : 0;
+}
+
+double dialog_queue_wait_max() {
+  std::lock_guard<std::mutex> lock(scheduler_mutex);
+  return scheduler_wait_max;
+}
+
+double widget_get_daemon() {
+  return dialog_module::widget_get_daemon();
+}
+
+double widget_set_daemon(double enable) {
+  dialog_module::widget_set_daemon((int)enable);
+  return 0;
+}
+
+double widget_get_tracing() {
+  return dialog_module::widget_get_tracing();
+}
+
+double widget_set_tracing(double enable) {
+  dialog_module::widget_set_tracing((int)enable);
+  return 0;
+}
+
+double widget_get_utf8_repair() {
+  return dialog_module::widget_get_utf8_repair();
+}
+
+double widget_set_utf8_repair(double enable) {
+  dialog_module::widget_set_utf8_repair((int)enable);
+  return 0;
+}
+
+double widget_get_counters() {
+  return dialog_module::widget_get_counters();
+}
+
+double widget_set_counters(double enable) {
+  dialog_module::widget_set_counters((int)enable);
+  return 0;
+}
+
+double dialog_trace_dump(char *path) {
+  return dialog_module::dialog_trace_dump(path);
+}
+
+double dialog_mock_push(char *answer, double delay) {
+  dialog_module::dialog_mock_push(answer, delay);
+  return 0;
+}
+
+double dialog_mock_load(char *fname) {
+  return dialog_module::dialog_mock_load(fname);
+}
+
+double dialog_mock_clear() {
+  dialog_module::dialog_mock_clear();
+  return 0;
+}
+
+char *dialog_metrics_snapshot() {
+  return dialog_module::dialog_metrics_snapshot();
+}
+
+char *dialog_counters_snapshot() {
+  return dialog_module::dialog_counters_snapshot();
+}
+
+double widget_save_settings() {
+  return dialog_module::widget_save_settings();
+}
+
+double widget_restore_settings(double id) {
+  dialog_module::widget_restore_settings((int)id);
+  return 0;
+}
+
+double widget_free_settings(double id) {
+  dialog_module::widget_free_settings((int)id);
+  return 0;
+}
+
+double dialog_prepare(double type, char *title, char *filter) {
+  return dialog_module::dialog_prepare((int)type, title, filter);
+}
+
+double dialog_prepared_show(double id, char *str) {
+  return dialog_module::dialog_prepared_show((int)id, str);
+}
+
+char *dialog_prepared_get(double id, char *str) {
+  return dialog_module::dialog_prepared_get((int)id, str);
+}
+
+double dialog_prepared_free(double id) {
+  dialog_module::dialog_prepared_free((int)id);
+  return 0;
+}
+
+double progress_open(char *str) {
+  return dialog_module::progress_open(str);
+}
+
+double progress_update(double id, double value) {
+  return dialog_module::progress_update((int)id, value);
+}
+
+double progress_set_text(double id, char *str) {
+  dialog_module::progress_set_text((int)id, str);
+  return 0;
+}
+
+double progress_close(double id) {
+  dialog_module::progress_close((int)id);
+  return 0;
+}
+
 void RegisterCallbacks(char *arg1, char *arg2, char *arg3, char *arg4) {
   void(*CreateAsynEventWithDSMapPtr)(int, int) = (void(*)(int, int))(arg1);
   int(*CreateDsMapPtr)(int _num, ...) = (int(*)(int _num, ...))(arg2);
@@ -26,16 +26,41 @@
 
 namespace dialog_module {
 
+  enum DIALOG_TYPES {
+    DIALOG_MESSAGE,
+    DIALOG_MESSAGE_CANCELABLE,
+    DIALOG_QUESTION,
+    DIALOG_QUESTION_CANCELABLE,
+    DIALOG_ATTEMPT,
+    DIALOG_ERROR,
+    DIALOG_ERROR_ABORT,
+    DIALOG_GET_STRING,
+    DIALOG_GET_PASSWORD,
+    DIALOG_OPEN_FILENAME,
+    DIALOG_OPEN_FILENAMES,
+    DIALOG_SAVE_FILENAME,
+    DIALOG_DIRECTORY
+  };
+
+  // returns the next row of a list dialog, or nullptr after the last one
+  typedef const char *(*list_next_t)(void *data);
+
   int show_message(char *str);
   int show_message_cancelable(char *str);
   int show_question(char *str);
   int show_question_cancelable(char *str);
   int show_attempt(char *str);
   int show_error(char *str, bool abort);
+  int show_text_fd(int fd);
+  int show_text_file(char *fname);
+  void notify(char *str);
   char *get_string(char *str, char *def);
   char *get_password(char *str, char *def);
   double get_integer(char *str, double def);
   double get_passcode(char *str, double def);
+  char *get_form(char *str, char *fields);
+  char *get_list(char *str, char *column, list_next_t next, void *data);
+  char *get_list_file(char *str, char *column, char *fname);
   char *get_open_filename(char *filter, char *fname);
   char *get_open_filename_ext(char *filter, char *fname, char *dir, char *title);
   char *get_open_filenames(char *filter, char *fname);
@@ -56,6 +81,32 @@ namespace dialog_module {
   void widget_set_system(char *sys);
   void widget_set_button_name(int type, char *name);
   char *widget_get_button_name(int type);
+  int widget_get_daemon();
+  void widget_set_daemon(int enable);
+  int widget_get_tracing();
+  void widget_set_tracing(int enable);
+  int widget_get_utf8_repair();
+  void widget_set_utf8_repair(int enable);
+  int widget_get_counters();
+  void widget_set_counters(int enable);
+  int dialog_trace_dump(char *path);
+  void dialog_mock_push(char *answer, double delay);
+  int dialog_mock_load(char *fname);
+  void dialog_mock_clear();
+  char *dialog_metrics_snapshot();
+  char *dialog_counters_snapshot();
+  int widget_save_settings();
+  void widget_restore_settings(int id);
+  void widget_free_settings(int id);
+  void widget_use_settings(int id);
+  int dialog_prepare(int type, char *title, char *filter);
+  int dialog_prepared_show(int id, char *str);
+  char *dialog_prepared_get(int id, char *str);
+  void dialog_prepared_free(int id);
+  int progress_open(char *str);
+  int progress_update(int id, double value);
+  void progress_set_text(int id, char *str);
+  void progress_close(int id);
   
 } // namespace dialog_module
 
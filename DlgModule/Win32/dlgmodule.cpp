@@ -32,6 +32,9 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
 
 #include "../Universal/dlgmodule.h"
 
@@ -108,6 +111,109 @@ namespace dialog_module {
     int const btn_array_len = 7;
     string btn_array[btn_array_len] = { "Abort", "Ignore", "OK", "Cancel", "Yes", "No", "Retry" };
 
+    // saved widget settings
+    struct widget_settings {
+      void *owner;
+      string caption;
+      string icon;
+      string btn_array[btn_array_len];
+    };
+
+    std::map<int, widget_settings> settings_saved;
+    int settings_saved_id = 0;
+
+    // prepared dialogs
+    struct prepared_dialog {
+      int type;
+      string title;
+      string filter;
+    };
+
+    std::map<int, prepared_dialog> prepared_dialogs;
+    int prepared_id = 0;
+
+    // progress dialogs; each one is created on, and only ever called from, a
+    // thread of its own with its own apartment, which picks up the latest
+    // value and text once per frame. the callers only store them
+    int const progress_max = 16;
+    ULONGLONG const progress_frame = 16;
+
+    struct progress_dialog {
+      std::atomic<bool> open{false};
+      std::atomic<bool> alive{false};
+      std::atomic<bool> closing{false};
+      std::atomic<double> value{0};
+      std::mutex mutex;
+      wstring text;
+      unsigned text_serial = 0;
+      wstring title;
+      HWND owner = NULL;
+      HANDLE ready = NULL;
+      HANDLE wake = NULL;
+      HANDLE thread = NULL;
+    };
+
+    progress_dialog progress_dialogs[progress_max];
+
+    DWORD WINAPI progress_thread(LPVOID param) {
+      progress_dialog *dlg = (progress_dialog *)param;
+      CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+      IProgressDialog *dialog = NULL;
+      unsigned text_serial = 0;
+      if (SUCCEEDED(CoCreateInstance(CLSID_ProgressDialog, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&dialog)))) {
+        wstring wstr_text;
+        {
+          std::lock_guard<std::mutex> lock(dlg->mutex);
+          wstr_text = dlg->text;
+          text_serial = dlg->text_serial;
+        }
+        dialog->SetTitle(dlg->title.c_str());
+        dialog->SetLine(1, wstr_text.c_str(), FALSE, NULL);
+        dialog->StartProgressDialog(dlg->owner, NULL, PROGDLG_NORMAL | PROGDLG_AUTOTIME, NULL);
+        dialog->SetProgress(0, 100);
+        dlg->alive.store(true);
+      } else {
+        dialog = NULL;
+      }
+      SetEvent(dlg->ready);
+      DWORD percent = 0;
+      while (dialog && !dlg->closing.load()) {
+        // sleep out the frame, answering whatever COM sends this apartment meanwhile
+        MsgWaitForMultipleObjects(1, &dlg->wake, FALSE, (DWORD)progress_frame, QS_ALLINPUT);
+        MSG msg;
+        while (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE)) {
+          TranslateMessage(&msg);
+          DispatchMessageW(&msg);
+        }
+        double value = dlg->value.load(std::memory_order_relaxed);
+        DWORD next = (value > 100) ? 100 : ((value > 0) ? (DWORD)value : 0);
+        if (next != percent) {
+          percent = next;
+          dialog->SetProgress(percent, 100);
+        }
+        wstring wstr_text;
+        bool text_changed = false;
+        {
+          std::lock_guard<std::mutex> lock(dlg->mutex);
+          if (dlg->text_serial != text_serial) {
+            wstr_text = dlg->text;
+            text_serial = dlg->text_serial;
+            text_changed = true;
+          }
+        }
+        if (text_changed)
+          dialog->SetLine(1, wstr_text.c_str(), FALSE, NULL);
+        if (dialog->HasUserCancelled())
+          dlg->alive.store(false, std::memory_order_relaxed);
+      }
+      if (dialog) {
+        dialog->StopProgressDialog();
+        dialog->Release();
+      }
+      CoUninitialize();
+      return 0;
+    }
+
     wstring widen(string tstr) {
       size_t wchar_count = tstr.size() + 1;
       vector<wchar_t> buf(wchar_count);
@@ -769,6 +875,18 @@ namespace dialog_module {
     return result;
   }
 
+  // no native text viewer on this platform yet
+  int show_text_fd(int fd) {
+    return 0;
+  }
+
+  int show_text_file(char *fname) {
+    return 0;
+  }
+
+  // no notification support on this platform yet, so they are dropped
+  void notify(char *str) { }
+
 
   #ifdef _MSC_VER
   char *get_string(char *str, char *def) {
@@ -788,6 +906,48 @@ namespace dialog_module {
   }
   #endif
 
+  char *get_form(char *str, char *fields) {
+    // no native form, so ask for each "Label|type" pair in turn
+    vector<string> stringVec;
+    string str_fields = fields;
+    size_t pos = 0, next;
+    while ((next = str_fields.find('|', pos)) != string::npos) {
+      stringVec.push_back(str_fields.substr(pos, next - pos));
+      pos = next + 1;
+    }
+    stringVec.push_back(str_fields.substr(pos));
+
+    static string result; result = "";
+    for (size_t i = 0; i < stringVec.size(); i += 2) {
+      string label = stringVec[i];
+      string type = (i + 1 < stringVec.size()) ? stringVec[i + 1] : "text";
+      string prompt = (i == 0 && string(str) != "") ? string(str) + "\n\n" + label : label;
+      string value;
+      if (type == "password") {
+        value = get_password((char *)prompt.c_str(), (char *)"");
+      } else if (type == "integer") {
+        value = remove_trailing_zeros(get_integer((char *)prompt.c_str(), 0));
+      } else if (type.compare(0, 6, "combo:") == 0) {
+        string values = type.substr(6);
+        prompt += " (" + string_replace_all(values, ";", ", ") + ")";
+        value = get_string((char *)prompt.c_str(), (char *)values.substr(0, values.find(';')).c_str());
+      } else {
+        value = get_string((char *)prompt.c_str(), (char *)"");
+      }
+      result += (i ? "\n" : "") + value;
+    }
+    return (char *)result.c_str();
+  }
+
+  // no native list dialog on this platform yet
+  char *get_list(char *str, char *column, list_next_t next, void *data) {
+    return (char *)"";
+  }
+
+  char *get_list_file(char *str, char *column, char *fname) {
+    return get_list(str, column, NULL, NULL);
+  }
+
   char *get_open_filename(char *filter, char *fname) {
     string str_filter = filter; string str_fname = fname; static string result;
     DWORD ThreadID = GetCurrentThreadId();
@@ -940,4 +1100,210 @@ namespace dialog_module {
     return (char *)btn_array[type].c_str();
   }
 
+  // dialogs are native here, there is no daemon to hand them to
+  int widget_get_daemon() {
+    return 0;
+  }
+
+  void widget_set_daemon(int enable) { }
+
+  // the traced phases belong to the zenity and kdialog engines; the dump
+  // still writes a valid trace here, it is just empty
+  int widget_get_tracing() {
+    return 0;
+  }
+
+  void widget_set_tracing(int enable) { }
+
+  // text is converted to UTF-16 for the Windows API, which does its own
+  // replacing of invalid sequences
+  int widget_get_utf8_repair() {
+    return 0;
+  }
+
+  void widget_set_utf8_repair(int enable) { }
+
+  // the counted sites are in the zenity and kdialog code paths
+  int widget_get_counters() {
+    return 0;
+  }
+
+  void widget_set_counters(int enable) { }
+
+  int dialog_trace_dump(char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) return 0;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[]}\n", file);
+    return (fclose(file) == 0);
+  }
+
+  // the "Mock" system is only there for the zenity and kdialog builds
+  void dialog_mock_push(char *answer, double delay) { }
+
+  int dialog_mock_load(char *fname) {
+    return 0;
+  }
+
+  void dialog_mock_clear() { }
+
+  // only the zenity and kdialog engines keep metrics so far
+  char *dialog_metrics_snapshot() {
+    return (char *)"{}";
+  }
+
+  char *dialog_counters_snapshot() {
+    return (char *)"{}";
+  }
+
+  int widget_save_settings() {
+    widget_settings saved;
+    saved.owner = owner;
+    saved.caption = caption;
+    saved.icon = tstr_icon;
+    for (int i = 0; i < btn_array_len; i++)
+      saved.btn_array[i] = btn_array[i];
+    settings_saved[settings_saved_id] = saved;
+    return settings_saved_id++;
+  }
+
+  void widget_restore_settings(int id) {
+    std::map<int, widget_settings>::iterator saved = settings_saved.find(id);
+    if (saved == settings_saved.end()) return;
+    owner = saved->second.owner;
+    caption = saved->second.caption;
+    tstr_icon = saved->second.icon;
+    for (int i = 0; i < btn_array_len; i++)
+      btn_array[i] = saved->second.btn_array[i];
+  }
+
+  void widget_free_settings(int id) {
+    settings_saved.erase(id);
+  }
+
+  // the settings here are plain globals that every thread shares, so a
+  // queued dialog still shows with whatever is set when it starts
+  void widget_use_settings(int id) { }
+
+  int dialog_prepare(int type, char *title, char *filter) {
+    if (type < DIALOG_MESSAGE || type > DIALOG_DIRECTORY) return -1;
+    prepared_dialog prepared;
+    prepared.type = type;
+    prepared.title = title ? title : "";
+    prepared.filter = filter ? filter : "";
+    prepared_dialogs[prepared_id] = prepared;
+    return prepared_id++;
+  }
+
+  int dialog_prepared_show(int id, char *str) {
+    std::map<int, prepared_dialog>::iterator found = prepared_dialogs.find(id);
+    if (found == prepared_dialogs.end()) return 0;
+    string caption_previous = caption;
+    if (found->second.title != "") caption = found->second.title;
+    int result = 0;
+    switch (found->second.type) {
+      case DIALOG_MESSAGE:             result = show_message(str); break;
+      case DIALOG_MESSAGE_CANCELABLE:  result = show_message_cancelable(str); break;
+      case DIALOG_QUESTION:            result = show_question(str); break;
+      case DIALOG_QUESTION_CANCELABLE: result = show_question_cancelable(str); break;
+      case DIALOG_ATTEMPT:             result = show_attempt(str); break;
+      case DIALOG_ERROR:               result = show_error(str, false); break;
+      case DIALOG_ERROR_ABORT:         result = show_error(str, true); break;
+    }
+    caption = caption_previous;
+    return result;
+  }
+
+  char *dialog_prepared_get(int id, char *str) {
+    std::map<int, prepared_dialog>::iterator found = prepared_dialogs.find(id);
+    if (found == prepared_dialogs.end()) return (char *)"";
+    char *filter = (char *)found->second.filter.c_str();
+    char *title = (char *)found->second.title.c_str();
+    switch (found->second.type) {
+      case DIALOG_OPEN_FILENAME:  return get_open_filename_ext(filter, str, (char *)"", title);
+      case DIALOG_OPEN_FILENAMES: return get_open_filenames_ext(filter, str, (char *)"", title);
+      case DIALOG_SAVE_FILENAME:  return get_save_filename_ext(filter, str, (char *)"", title);
+      case DIALOG_DIRECTORY:      return get_directory_alt(title, str);
+    }
+    string caption_previous = caption;
+    if (found->second.title != "") caption = found->second.title;
+    char *result = (char *)"";
+    if (found->second.type == DIALOG_GET_STRING) result = get_string(str, (char *)"");
+    if (found->second.type == DIALOG_GET_PASSWORD) result = get_password(str, (char *)"");
+    caption = caption_previous;
+    return result;
+  }
+
+  void dialog_prepared_free(int id) {
+    prepared_dialogs.erase(id);
+  }
+
+  int progress_open(char *str) {
+    int id = -1;
+    for (int i = 0; i < progress_max && id == -1; i++) {
+      bool expected = false;
+      if (progress_dialogs[i].open.compare_exchange_strong(expected, true)) id = i;
+    }
+    if (id == -1) return -1;
+    progress_dialog *dlg = &progress_dialogs[id];
+    {
+      std::lock_guard<std::mutex> lock(dlg->mutex);
+      dlg->text = widen(str ? str : "");
+      dlg->text_serial++;
+    }
+    dlg->value.store(0);
+    dlg->title = widen((caption == "") ? "Progress" : caption);
+    dlg->owner = owner_window();
+    dlg->ready = CreateEventW(NULL, TRUE, FALSE, NULL);
+    dlg->wake = CreateEventW(NULL, FALSE, FALSE, NULL);
+    dlg->thread = CreateThread(NULL, 0, progress_thread, dlg, 0, NULL);
+    if (dlg->thread) {
+      WaitForSingleObject(dlg->ready, INFINITE);
+      if (!dlg->alive.load()) WaitForSingleObject(dlg->thread, INFINITE);
+    }
+    CloseHandle(dlg->ready);
+    dlg->ready = NULL;
+    if (!dlg->alive.load()) {
+      if (dlg->thread) CloseHandle(dlg->thread);
+      CloseHandle(dlg->wake);
+      dlg->thread = NULL;
+      dlg->wake = NULL;
+      dlg->open.store(false);
+      return -1;
+    }
+    return id;
+  }
+
+  int progress_update(int id, double value) {
+    if (id < 0 || id >= progress_max || !progress_dialogs[id].open.load(std::memory_order_acquire)) return 0;
+    progress_dialog *dlg = &progress_dialogs[id];
+    dlg->value.store(value, std::memory_order_relaxed);
+    return dlg->alive.load(std::memory_order_relaxed);
+  }
+
+  void progress_set_text(int id, char *str) {
+    if (id < 0 || id >= progress_max || !progress_dialogs[id].open.load(std::memory_order_acquire)) return;
+    progress_dialog *dlg = &progress_dialogs[id];
+    wstring wstr_text = widen(str ? str : "");
+    std::lock_guard<std::mutex> lock(dlg->mutex);
+    dlg->text = wstr_text;
+    dlg->text_serial++;
+  }
+
+  void progress_close(int id) {
+    if (id < 0 || id >= progress_max || !progress_dialogs[id].open.load(std::memory_order_acquire)) return;
+    progress_dialog *dlg = &progress_dialogs[id];
+    // the first caller to get here closes it; updates meanwhile only store a value
+    bool expected = false;
+    if (!dlg->closing.compare_exchange_strong(expected, true)) return;
+    dlg->alive.store(false);
+    SetEvent(dlg->wake);
+    WaitForSingleObject(dlg->thread, INFINITE);
+    CloseHandle(dlg->thread);
+    CloseHandle(dlg->wake);
+    dlg->thread = NULL;
+    dlg->wake = NULL;
+    dlg->closing.store(false);
+    dlg->open.store(false, std::memory_order_release);
+  }
+
 } // namespace dialog_module
@@ -29,10 +29,21 @@
 #include <cstdlib>
 #include <cstring>
 #include <climits>
+#include <cstdint>
 
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <deque>
+#include <memory>
+#include <future>
 #include <sstream>
 #include <vector>
+#include <unordered_map>
 #include <string>
 #include <algorithm>
 
@@ -43,23 +54,56 @@
 #if defined (__APPLE__) && defined(__MACH__)
 #include <sys/sysctl.h>
 #include <libproc.h>
-#elif defined(__linux__) && !defined(__ANDROID__)
-#include <proc/readproc.h>
 #elif defined(__FreeBSD__)
 #include <sys/sysctl.h>
 #include <sys/user.h>
 #include <libutil.h>
+#elif defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #endif
 
-#include <X11/Xlib.h>
-#include <X11/Xatom.h>
-#include <X11/Xutil.h>
+#include <xcb/xcb.h>
 
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/file.h>
+#include <poll.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <libgen.h>
 #include <unistd.h>
+#include <dlfcn.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <pthread.h>
+#include <errno.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DLGMOD_AVX2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// USDT probes under the dlgmod provider, for bpftrace and SystemTap; each
+// one is a nop until something attaches, and without sys/sdt.h nothing at all
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define DLGMOD_PROBE1(name, arg1) DTRACE_PROBE1(dlgmod, name, arg1)
+#define DLGMOD_PROBE2(name, arg1, arg2) DTRACE_PROBE2(dlgmod, name, arg1, arg2)
+#endif
+#endif
+#ifndef DLGMOD_PROBE1
+#define DLGMOD_PROBE1(name, arg1) do { } while (0)
+#define DLGMOD_PROBE2(name, arg1, arg2) do { } while (0)
+#endif
 
 using std::string;
 using std::to_string;
@@ -76,12 +120,11 @@ namespace {
 int const dm_x11     = -1;
 int const dm_zenity  =  0;
 int const dm_kdialog =  1;
-int dm_dialogengine  = -1;
+int const dm_gtk     =  2;
+int const dm_portal  =  3;
+int const dm_mock    =  4;
 
 process_t proc = 0;
-void *owner = nullptr;
-string caption;
-string current_icon;
 
 enum BUTTON_TYPES {
   BUTTON_ABORT,
@@ -94,10 +137,34 @@ enum BUTTON_TYPES {
 };
 
 int const btn_array_len = 7;
-string btn_array[btn_array_len] = { "Abort", "Ignore", "OK", "Cancel", "Yes", "No", "Retry" };
 
-bool message_cancel  = false;
-bool question_cancel = false;
+// everything the widget_set_* functions configure; a published version is
+// never modified, setters publish an edited copy in its place instead
+struct dialog_settings {
+  int engine = dm_x11;
+  xcb_window_t owner = 0;
+  string caption;
+  string current_icon;
+  string btn_array[btn_array_len] = { "Abort", "Ignore", "OK", "Cancel", "Yes", "No", "Retry" };
+};
+
+// the published version. a reader takes its reference inside a grace
+// period counted against the current generation, and never waits on
+// anything; a setter swaps the pointer, starts the next generation and
+// waits for the readers still in the last one before it lets the old
+// pointer go. the version itself lives on for as long as a reader keeps it
+std::atomic<const std::shared_ptr<const dialog_settings> *> settings(
+  new std::shared_ptr<const dialog_settings>(std::make_shared<dialog_settings>()));
+std::atomic<unsigned> settings_generation(0);
+std::atomic<unsigned> settings_readers[2] = { {0}, {0} };
+
+// setters are serialized against each other, but never against readers
+std::mutex settings_writer_mutex;
+// set by widget_use_settings() for dialogs that must show with the settings
+// of the moment they were asked for rather than the current ones
+thread_local std::shared_ptr<const dialog_settings> settings_thread;
+std::map<int, dialog_settings> settings_saved;
+int settings_saved_id = 0;
 
 bool dialog_position = false;
 bool dialog_size     = false;
@@ -107,16 +174,383 @@ int      dialog_ypos   = 0;
 unsigned dialog_width  = 0;
 unsigned dialog_height = 0;
 
-void change_relative_to_kwin() {
-  setenv("WAYLAND_DISPLAY", "", 1);
-  if (dm_dialogengine == dm_x11) {
-    Display *display = XOpenDisplay(nullptr);
-    Atom aKWinRunning = XInternAtom(display, "KWIN_RUNNING", true);
-    bool bKWinRunning = (aKWinRunning != None);
-    if (bKWinRunning) dm_dialogengine = dm_kdialog;
-    else dm_dialogengine = dm_zenity;
-    XCloseDisplay(display);
+// everything a single dialog needs, captured once when it is requested
+// so concurrent dialogs never read or write each other's settings
+struct dialog_context {
+  // the shell engine; gtk is set when the in-process GTK engine takes the
+  // dialogs it can show, portal when the desktop portal takes the file
+  // dialogs, and the rest still go to engine. mock builds zenity commands
+  // but answers them from the mock script instead of running them
+  int engine;
+  bool gtk;
+  bool portal;
+  bool mock;
+  xcb_window_t owner;
+  string caption;
+  string icon;
+  string btn_array[btn_array_len];
+};
+
+std::shared_ptr<const dialog_settings> settings_snapshot() {
+  if (settings_thread) return settings_thread;
+  for (;;) {
+    // a setter that moved on in between may not have seen us; try again
+    unsigned generation = settings_generation.load();
+    std::atomic<unsigned> &readers = settings_readers[generation & 1];
+    readers.fetch_add(1);
+    if (settings_generation.load() == generation) {
+      std::shared_ptr<const dialog_settings> result = *settings.load();
+      readers.fetch_sub(1);
+      return result;
+    }
+    readers.fetch_sub(1);
+  }
+}
+
+// expects settings_writer_mutex to be held
+void settings_publish(std::shared_ptr<const dialog_settings> next) {
+  const std::shared_ptr<const dialog_settings> *last = settings.exchange(new std::shared_ptr<const dialog_settings>(std::move(next)));
+  unsigned generation = settings_generation.fetch_add(1);
+  while (settings_readers[generation & 1].load())
+    std::this_thread::yield();
+  delete last;
+}
+
+void settings_modify(std::function<void(dialog_settings &)> modify) {
+  std::lock_guard<std::mutex> lock(settings_writer_mutex);
+  std::shared_ptr<dialog_settings> next = std::make_shared<dialog_settings>(**settings.load());
+  modify(*next);
+  settings_publish(next);
+}
+
+// metrics: counters and latency histograms that are always kept, for
+// dialog_metrics_snapshot() to report. they live in a shared anonymous
+// page, so the forked decorators count their connections, atoms and icon
+// decodes into the same place as the process that started them
+enum metric_counter {
+  metric_spawns,
+  metric_decorators,
+  metric_x_connections,
+  metric_atoms_interned,
+  metric_icon_decodes,
+  metric_prepared_hits,
+  metric_pipe_bytes,
+  metric_invalid_utf8,
+  metric_counters
+};
+
+const char *const metric_counter_names[metric_counters] = {
+  "spawns", "decorators", "x_connections", "atoms_interned", "icon_decodes", "prepared_hits", "pipe_bytes", "invalid_utf8"
+};
+
+// the DIALOG_* types first, then the dialogs that have no type of their own
+enum metric_dialog {
+  metric_form = DIALOG_DIRECTORY + 1,
+  metric_list,
+  metric_text,
+  metric_color,
+  metric_progress,
+  metric_notify,
+  metric_dialogs
+};
+
+const char *const metric_dialog_names[metric_dialogs] = {
+  "message", "message_cancelable", "question", "question_cancelable", "attempt", "error", "error_abort",
+  "string", "password", "open_filename", "open_filenames", "save_filename", "directory",
+  "form", "list", "text", "color", "progress", "notify"
+};
+
+// the phases of a shell dialog, named as they appear in traces
+enum trace_phase {
+  phase_build,
+  phase_spawn,
+  phase_wait,
+  phase_drain,
+  phase_reap,
+  phase_reap_decorator,
+  phase_dialog,
+  phase_daemon,
+  phase_discover,
+  phase_decorate,
+  trace_phases
+};
+
+const char *const trace_phase_names[trace_phases] = {
+  "build", "spawn", "wait", "drain", "reap", "reap decorator", "dialog", "daemon", "discover", "decorate"
+};
+
+// the CPU-bound helpers that widget_set_counters() measures; a site's
+// counts include the sites it calls, the filters spending part of theirs
+// in add_escaping() and string_split(). command_build is
+// command_builder::finish() writing a command out, escaping included
+enum counter_site {
+  counter_icon_decode,
+  counter_zenity_filter,
+  counter_kdialog_filter,
+  counter_add_escaping,
+  counter_string_split,
+  counter_command_build,
+  counter_sites
+};
+
+const char *const counter_site_names[counter_sites] = {
+  "icon_decode", "zenity_filter", "kdialog_filter", "add_escaping", "string_split", "command_build"
+};
+
+// in the order they join a thread's group, the task clock leading it
+enum counter_event {
+  event_task_clock,
+  event_cycles,
+  event_instructions,
+  event_cache_misses,
+  event_branch_misses,
+  counter_events
+};
+
+const char *const counter_event_names[counter_events] = {
+  "task_ns", "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+// bucket 0 is under 1 us, bucket i under 2^i us, the last one unbounded
+unsigned const metric_buckets = 24;
+
+struct dialog_metrics {
+  std::atomic<uint64_t> dialogs[metric_dialogs];
+  std::atomic<uint64_t> counters[metric_counters];
+  std::atomic<uint64_t> phase_total[trace_phases];
+  std::atomic<uint64_t> phase_buckets[trace_phases][metric_buckets];
+  std::atomic<uint64_t> site_calls[counter_sites];
+  std::atomic<uint64_t> site_events[counter_sites][counter_events];
+  std::atomic<uint32_t> events_counted;
+  std::atomic<uint32_t> groups_failed;
+};
+
+dialog_metrics &metrics() {
+  static dialog_metrics *shared = []() {
+    void *page = mmap(nullptr, sizeof(dialog_metrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return (page == MAP_FAILED) ? new dialog_metrics() : new (page) dialog_metrics();
+  }();
+  return *shared;
+}
+
+void metrics_count(metric_counter counter, uint64_t amount = 1) {
+  metrics().counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void metrics_dialog(int type) {
+  if (type >= 0 && type < metric_dialogs)
+    metrics().dialogs[type].fetch_add(1, std::memory_order_relaxed);
+}
+
+void metrics_observe(trace_phase phase, uint64_t nanoseconds) {
+  uint64_t us = nanoseconds / 1000;
+  unsigned bucket = 0;
+  while (us && bucket < metric_buckets - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  dialog_metrics &current = metrics();
+  current.phase_total[phase].fetch_add(nanoseconds / 1000, std::memory_order_relaxed);
+  current.phase_buckets[phase][bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// hardware counters: off by default, since every measured call costs two
+// read() system calls. each thread opens one perf_event_open group the first
+// time it measures something, and a scope adds the difference between two
+// reads of it to its site in the metrics page; the decorator, which does the
+// icon decoding, opens its own after the fork. events the kernel, the CPU or
+// a VM cannot count are left out of the group rather than failing it
+std::atomic<bool> counters_enabled(false);
+
+struct counter_group {
+  int fds[counter_events] = { -1, -1, -1, -1, -1 };
+  // where each event is in a PERF_FORMAT_GROUP read, -1 if it is not counted
+  int slots[counter_events] = { -1, -1, -1, -1, -1 };
+  int members = 0;
+  bool opened = false;
+  ~counter_group() {
+    for (int fd : fds)
+      if (fd != -1) close(fd);
+  }
+};
+
+thread_local counter_group counter_thread;
+
+int counter_open(counter_event event, int leader) {
+  #if defined(__linux__)
+  static const uint32_t types[counter_events] = {
+    PERF_TYPE_SOFTWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE
+  };
+  static const uint64_t configs[counter_events] = {
+    PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+  };
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = types[event];
+  attr.config = configs[event];
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+  #else
+  return -1;
+  #endif
+}
+
+counter_group &counter_thread_group() {
+  counter_group &group = counter_thread;
+  if (group.opened) return group;
+  group.opened = true;
+  uint32_t counted = 0;
+  for (int i = 0; i < counter_events; i++) {
+    int fd = counter_open((counter_event)i, group.fds[event_task_clock]);
+    if (fd == -1) {
+      // without a leader there is no group to join
+      if (i == event_task_clock) break;
+      continue;
+    }
+    group.fds[i] = fd;
+    group.slots[i] = group.members++;
+    counted |= 1u << i;
+  }
+  if (counted) metrics().events_counted.fetch_or(counted, std::memory_order_relaxed);
+  else metrics().groups_failed.fetch_add(1, std::memory_order_relaxed);
+  return group;
+}
+
+// a forked child shares its parent's descriptors only until it closes them,
+// and they count the parent's thread anyway; it starts over with its own
+void counter_thread_forget() {
+  counter_group &group = counter_thread;
+  for (int i = 0; i < counter_events; i++)
+    group.fds[i] = group.slots[i] = -1;
+  group.members = 0;
+  group.opened = false;
+}
+
+bool counter_read(const counter_group &group, uint64_t values[counter_events + 1]) {
+  ssize_t expected = (ssize_t)((group.members + 1) * sizeof(uint64_t));
+  return group.members && read(group.fds[event_task_clock], values, expected) == expected;
+}
+
+struct counter_scope {
+  counter_site site;
+  counter_group *group = nullptr;
+  uint64_t start[counter_events + 1];
+  counter_scope(counter_site site) : site(site) {
+    if (!counters_enabled.load(std::memory_order_relaxed)) return;
+    counter_group &current = counter_thread_group();
+    if (counter_read(current, start)) group = &current;
+  }
+  ~counter_scope() {
+    uint64_t end[counter_events + 1];
+    if (!group || !counter_read(*group, end)) return;
+    dialog_metrics &current = metrics();
+    current.site_calls[site].fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < counter_events; i++) {
+      int slot = group->slots[i];
+      if (slot != -1)
+        current.site_events[site][i].fetch_add(end[slot + 1] - start[slot + 1], std::memory_order_relaxed);
+    }
+  }
+};
+
+template <typename T>
+bool library_symbol(void *library, const char *name, T &function) {
+  function = (T)dlsym(library, name);
+  return function != nullptr;
+}
+
+// libxcb is opened with dlopen() the first time a window is looked at, so
+// processes that never show a dialog do not pay for loading it; the header
+// is still used for the types and constants
+struct xcb_api {
+  xcb_connection_t *(*connect)(const char *, int *);
+  int (*connection_has_error)(xcb_connection_t *);
+  void (*disconnect)(xcb_connection_t *);
+  int (*flush)(xcb_connection_t *);
+  const xcb_setup_t *(*get_setup)(xcb_connection_t *);
+  xcb_screen_iterator_t (*setup_roots_iterator)(const xcb_setup_t *);
+  void (*prefetch_maximum_request_length)(xcb_connection_t *);
+  uint32_t (*get_maximum_request_length)(xcb_connection_t *);
+  xcb_intern_atom_cookie_t (*intern_atom)(xcb_connection_t *, uint8_t, uint16_t, const char *);
+  xcb_intern_atom_reply_t *(*intern_atom_reply)(xcb_connection_t *, xcb_intern_atom_cookie_t, xcb_generic_error_t **);
+  xcb_get_property_cookie_t (*get_property)(xcb_connection_t *, uint8_t, xcb_window_t, xcb_atom_t, xcb_atom_t, uint32_t, uint32_t);
+  xcb_get_property_reply_t *(*get_property_reply)(xcb_connection_t *, xcb_get_property_cookie_t, xcb_generic_error_t **);
+  void *(*get_property_value)(const xcb_get_property_reply_t *);
+  int (*get_property_value_length)(const xcb_get_property_reply_t *);
+  xcb_void_cookie_t (*change_property)(xcb_connection_t *, uint8_t, xcb_window_t, xcb_atom_t, xcb_atom_t, uint8_t, uint32_t, const void *);
+  xcb_void_cookie_t (*change_window_attributes)(xcb_connection_t *, xcb_window_t, uint32_t, const void *);
+  int (*get_file_descriptor)(xcb_connection_t *);
+  xcb_generic_event_t *(*poll_for_event)(xcb_connection_t *);
+};
+
+xcb_api xcb;
+
+bool xcb_symbols(void *library) {
+  return library_symbol(library, "xcb_connect", xcb.connect) &&
+    library_symbol(library, "xcb_connection_has_error", xcb.connection_has_error) &&
+    library_symbol(library, "xcb_disconnect", xcb.disconnect) &&
+    library_symbol(library, "xcb_flush", xcb.flush) &&
+    library_symbol(library, "xcb_get_setup", xcb.get_setup) &&
+    library_symbol(library, "xcb_setup_roots_iterator", xcb.setup_roots_iterator) &&
+    library_symbol(library, "xcb_prefetch_maximum_request_length", xcb.prefetch_maximum_request_length) &&
+    library_symbol(library, "xcb_get_maximum_request_length", xcb.get_maximum_request_length) &&
+    library_symbol(library, "xcb_intern_atom", xcb.intern_atom) &&
+    library_symbol(library, "xcb_intern_atom_reply", xcb.intern_atom_reply) &&
+    library_symbol(library, "xcb_get_property", xcb.get_property) &&
+    library_symbol(library, "xcb_get_property_reply", xcb.get_property_reply) &&
+    library_symbol(library, "xcb_get_property_value", xcb.get_property_value) &&
+    library_symbol(library, "xcb_get_property_value_length", xcb.get_property_value_length) &&
+    library_symbol(library, "xcb_change_property", xcb.change_property) &&
+    library_symbol(library, "xcb_change_window_attributes", xcb.change_window_attributes) &&
+    library_symbol(library, "xcb_get_file_descriptor", xcb.get_file_descriptor) &&
+    library_symbol(library, "xcb_poll_for_event", xcb.poll_for_event);
+}
+
+// true once libxcb is loaded; only tried once, and without it there is
+// simply no window to decorate
+bool xcb_load() {
+  static std::once_flag xcb_flag;
+  static bool xcb_loaded = false;
+  std::call_once(xcb_flag, []() {
+    const char *names[] = { "libxcb.so.1", "libxcb.1.dylib", "/opt/X11/lib/libxcb.1.dylib" };
+    for (const char *name : names) {
+      if (void *library = dlopen(name, RTLD_NOW | RTLD_LOCAL)) {
+        xcb_loaded = xcb_symbols(library);
+        break;
+      }
+    }
+  });
+  return xcb_loaded;
+}
+
+int change_relative_to_kwin(int engine) {
+  static std::once_flag wayland_flag;
+  std::call_once(wayland_flag, []() { setenv("WAYLAND_DISPLAY", "", 1); });
+  if (engine == dm_x11) {
+    bool bKWinRunning = false;
+    if (xcb_load()) {
+      xcb_connection_t *connection = xcb.connect(nullptr, nullptr);
+      if (!xcb.connection_has_error(connection)) {
+        metrics_count(metric_x_connections);
+        metrics_count(metric_atoms_interned);
+        xcb_intern_atom_reply_t *reply = xcb.intern_atom_reply(connection,
+          xcb.intern_atom(connection, true, strlen("KWIN_RUNNING"), "KWIN_RUNNING"), nullptr);
+        bKWinRunning = (reply && reply->atom != XCB_ATOM_NONE);
+        free(reply);
+      }
+      xcb.disconnect(connection);
+    }
+    if (bKWinRunning) engine = dm_kdialog;
+    else engine = dm_zenity;
+    settings_modify([engine](dialog_settings &next) {
+      if (next.engine == dm_x11) next.engine = engine;
+    });
   }
+  return engine;
 }
 
 unsigned nlpo2dc(unsigned x) {
@@ -128,12 +562,13 @@ unsigned nlpo2dc(unsigned x) {
   return x | (x >> 16);
 }
 
-void XSetIcon(Display *display, Window window, const char *icon) {
-  XSynchronize(display, true);
-  Atom property = XInternAtom(display, "_NET_WM_ICON", true);
-
+// _NET_WM_ICON is a CARDINAL array of width, height and ARGB pixels; the
+// request is only queued here, it goes out with the next flush
+void window_set_icon(xcb_connection_t *connection, xcb_window_t window, xcb_atom_t property, const char *icon) {
   unsigned char *data = nullptr;
   unsigned pngwidth, pngheight;
+  counter_scope scope(counter_icon_decode);
+  metrics_count(metric_icon_decodes);
   unsigned error = lodepng_decode32_file(&data, &pngwidth, &pngheight, icon);
   if (error) return;
 
@@ -147,7 +582,7 @@ void XSetIcon(Display *display, Window window, const char *icon) {
 
   unsigned i = 0;
   unsigned elem_numb = 2 + pngwidth * pngheight;
-  unsigned long *result = new unsigned long[elem_numb]();
+  uint32_t *result = new uint32_t[elem_numb]();
 
   result[i++] = pngwidth;
   result[i++] = pngheight;
@@ -163,8 +598,11 @@ void XSetIcon(Display *display, Window window, const char *icon) {
     }
   }
 
-  XChangeProperty(display, window, property, XA_CARDINAL, 32, PropModeReplace, (unsigned char *)result, elem_numb);
-  XFlush(display);
+  // too long for the server even with BIG-REQUESTS would close the connection
+  if (property != XCB_ATOM_NONE && (elem_numb + 7) <= xcb.get_maximum_request_length(connection)) {
+    xcb.change_property(connection, XCB_PROP_MODE_REPLACE, window, property, XCB_ATOM_CARDINAL, 32, elem_numb, result);
+    DLGMOD_PROBE2(icon__applied, (unsigned long)window, icon);
+  }
   delete[] result;
   delete[] bitmap;
   delete[] data;
@@ -180,6 +618,7 @@ string string_replace_all(string str, string substr, string nstr) {
 }
 
 vector<string> string_split(string str, char delimiter) {
+  counter_scope scope(counter_string_split);
   vector<string> vec;
   std::stringstream sstr(str);
   string tmp;
@@ -188,7 +627,287 @@ vector<string> string_split(string str, char delimiter) {
   return vec;
 }
 
-bool file_exists(string fname) {
+// dialog text on its way to an engine: in a double-quoted shell argument
+// the four characters sh still acts on get a backslash, and the UTF-8 is
+// checked on the way, since GTK and Qt drop or garble text that is not.
+// with widget_set_utf8_repair(1) every byte that does not begin a
+// well-formed sequence comes out as U+FFFD. most text is ASCII with nothing
+// to escape, so a vector scan skips to the next byte worth a look and
+// everything before it is copied whole
+std::atomic<bool> utf8_repair(false);
+
+bool shell_special(unsigned char ch) {
+  return ch == '"' || ch == '\\' || ch == '$' || ch == '`';
+}
+
+// C0 controls other than tab and the line breaks: zenity's markup and Qt
+// reject or drop them, and a NUL would cut the command short, so in shell
+// text they always come out as U+FFFD
+bool shell_control(unsigned char ch) {
+  return ch < 0x20 && ch != '\t' && ch != '\n' && ch != '\r';
+}
+
+#if defined(DLGMOD_AVX2)
+__attribute__((target("avx2")))
+const char *text_scan_avx2(const char *str, const char *end, bool shell) {
+  const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+  const __m256i dollar = _mm256_set1_epi8('$'), backtick = _mm256_set1_epi8('`');
+  const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+  const __m256i newline = _mm256_set1_epi8('\n'), carriage = _mm256_set1_epi8('\r');
+  for (; end - str >= 32; str += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)str);
+    // the top bit of each byte from 0x80 up marks UTF-8 to check
+    unsigned mask = (unsigned)_mm256_movemask_epi8(block);
+    if (shell) {
+      __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_cmpeq_epi8(block, backslash)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, dollar), _mm256_cmpeq_epi8(block, backtick)));
+      // below the space, signed, and so the bytes from 0x80 up once more
+      __m256i allowed = _mm256_or_si256(_mm256_cmpeq_epi8(block, tab),
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, newline), _mm256_cmpeq_epi8(block, carriage)));
+      hit = _mm256_or_si256(hit, _mm256_andnot_si256(allowed, _mm256_cmpgt_epi8(space, block)));
+      mask |= (unsigned)_mm256_movemask_epi8(hit);
+    }
+    if (mask) return str + __builtin_ctz(mask);
+  }
+  return str;
+}
+#endif
+
+#if defined(__SSE2__)
+// the controls shell_control() takes, and the bytes from 0x80 up, which
+// the signed compare puts below the space as well
+__m128i text_controls_sse2(__m128i block) {
+  __m128i allowed = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\t')),
+    _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\r'))));
+  return _mm_andnot_si128(allowed, _mm_cmplt_epi8(block, _mm_set1_epi8(' ')));
+}
+
+const char *text_scan_sse2(const char *str, const char *end, bool shell) {
+  const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+  const __m128i dollar = _mm_set1_epi8('$'), backtick = _mm_set1_epi8('`');
+  for (; end - str >= 16; str += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)str);
+    unsigned mask = (unsigned)_mm_movemask_epi8(block);
+    if (shell) {
+      __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+        _mm_or_si128(_mm_cmpeq_epi8(block, dollar), _mm_cmpeq_epi8(block, backtick)));
+      mask |= (unsigned)_mm_movemask_epi8(_mm_or_si128(hit, text_controls_sse2(block)));
+    }
+    if (mask) return str + __builtin_ctz(mask);
+  }
+  return str;
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+// the controls shell_control() takes
+uint8x16_t text_controls_neon(uint8x16_t block) {
+  uint8x16_t allowed = vorrq_u8(vceqq_u8(block, vdupq_n_u8('\t')),
+    vorrq_u8(vceqq_u8(block, vdupq_n_u8('\n')), vceqq_u8(block, vdupq_n_u8('\r'))));
+  return vbicq_u8(vcltq_u8(block, vdupq_n_u8(' ')), allowed);
+}
+
+// NEON has no movemask, so a block with a hit is left for the scalar loop
+const char *text_scan_neon(const char *str, const char *end, bool shell) {
+  const uint8x16_t quote = vdupq_n_u8('"'), backslash = vdupq_n_u8('\\');
+  const uint8x16_t dollar = vdupq_n_u8('$'), backtick = vdupq_n_u8('`'), high = vdupq_n_u8(0x80);
+  for (; end - str >= 16; str += 16) {
+    uint8x16_t block = vld1q_u8((const uint8_t *)str);
+    uint8x16_t hit = vcgeq_u8(block, high);
+    if (shell) {
+      hit = vorrq_u8(hit, vorrq_u8(vorrq_u8(vceqq_u8(block, quote), vceqq_u8(block, backslash)),
+        vorrq_u8(vceqq_u8(block, dollar), vceqq_u8(block, backtick))));
+      hit = vorrq_u8(hit, text_controls_neon(block));
+    }
+    if (vmaxvq_u8(hit)) break;
+  }
+  return str;
+}
+#endif
+
+// the first byte from str on that is shell-special, a control or not ASCII, or end
+const char *text_scan(const char *str, const char *end, bool shell) {
+  #if defined(DLGMOD_AVX2)
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  if (avx2) str = text_scan_avx2(str, end, shell);
+  #endif
+  #if defined(__SSE2__)
+  str = text_scan_sse2(str, end, shell);
+  #elif defined(__aarch64__) && defined(__ARM_NEON)
+  str = text_scan_neon(str, end, shell);
+  #endif
+  while (str < end && !((unsigned char)*str & 0x80) && !(shell && (shell_special(*str) || shell_control(*str))))
+    str++;
+  return str;
+}
+
+// which of the 16 bytes at str are shell-special, and in high which need
+// to be looked at one by one: those that are not ASCII, and in shell text
+// the controls; text_mask_step bits a byte, since NEON has no movemask and
+// its lanes come out as nibbles
+#if defined(__aarch64__) && defined(__ARM_NEON) && !defined(__SSE2__)
+unsigned const text_mask_step = 4;
+#else
+unsigned const text_mask_step = 1;
+#endif
+
+uint64_t text_mask(const char *str, bool shell, uint64_t &high) {
+  #if defined(__SSE2__)
+  __m128i block = _mm_loadu_si128((const __m128i *)str);
+  high = (unsigned)_mm_movemask_epi8(block);
+  if (!shell) return 0;
+  high |= (unsigned)_mm_movemask_epi8(text_controls_sse2(block));
+  __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('"')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'))),
+    _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('$')), _mm_cmpeq_epi8(block, _mm_set1_epi8('`'))));
+  return (unsigned)_mm_movemask_epi8(hit);
+  #elif defined(__aarch64__) && defined(__ARM_NEON)
+  uint8x16_t block = vld1q_u8((const uint8_t *)str);
+  uint8x16_t top = vcgeq_u8(block, vdupq_n_u8(0x80));
+  if (shell) top = vorrq_u8(top, text_controls_neon(block));
+  high = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(top), 4)), 0);
+  if (!shell) return 0;
+  uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(block, vdupq_n_u8('"')), vceqq_u8(block, vdupq_n_u8('\\'))),
+    vorrq_u8(vceqq_u8(block, vdupq_n_u8('$')), vceqq_u8(block, vdupq_n_u8('`'))));
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+  #else
+  uint64_t mask = 0;
+  high = 0;
+  for (unsigned i = 0; i < 16; i++) {
+    unsigned char ch = str[i];
+    if ((ch & 0x80) || (shell && shell_control(ch))) high |= (uint64_t)1 << i;
+    else if (shell && shell_special(ch)) mask |= (uint64_t)1 << i;
+  }
+  return mask;
+  #endif
+}
+
+// the length of the well-formed UTF-8 sequence at str, 0 if there is none:
+// no overlong forms, surrogates or code points past U+10FFFF
+size_t utf8_sequence(const unsigned char *str, const unsigned char *end) {
+  unsigned char lead = str[0], low = 0x80, high = 0xBF;
+  size_t length;
+  if (lead >= 0xC2 && lead <= 0xDF) length = 2;
+  else if (lead >= 0xE0 && lead <= 0xEF) length = 3;
+  else if (lead >= 0xF0 && lead <= 0xF4) length = 4;
+  else return 0;
+  if (lead == 0xE0) low = 0xA0;
+  else if (lead == 0xED) high = 0x9F;
+  else if (lead == 0xF0) low = 0x90;
+  else if (lead == 0xF4) high = 0x8F;
+  if ((size_t)(end - str) < length || str[1] < low || str[1] > high) return 0;
+  for (size_t i = 2; i < length; i++)
+    if ((str[i] & 0xC0) != 0x80) return 0;
+  return length;
+}
+
+// one byte the scan stopped at, or the whole sequence it starts; returns
+// how many bytes of str that took. with controls set, a C0 control other
+// than tab or a line break is written as U+FFFD; paths keep theirs
+template <bool write>
+size_t text_put(char *out, size_t &written, const char *str, const char *end, bool shell, bool controls, bool repair, bool &invalid) {
+  unsigned char ch = *str;
+  if (controls && shell_control(ch)) {
+    if (write) memcpy(out + written, "\xEF\xBF\xBD", 3);
+    written += 3;
+    return 1;
+  }
+  if (!(ch & 0x80)) {
+    bool escape = shell && shell_special(ch);
+    if (write && escape) out[written] = '\\';
+    written += escape;
+    if (write) out[written] = ch;
+    written++;
+    return 1;
+  }
+  size_t sequence = utf8_sequence((const unsigned char *)str, (const unsigned char *)end);
+  if (sequence) {
+    for (size_t i = 0; write && i < sequence; i++)
+      out[written + i] = str[i];
+    written += sequence;
+    return sequence;
+  }
+  invalid = true;
+  if (write && repair) memcpy(out + written, "\xEF\xBF\xBD", 3);
+  else if (write) out[written] = ch;
+  written += repair ? 3 : 1;
+  return 1;
+}
+
+// writes str to out escaped for the shell if shell is set, with its controls
+// replaced too if controls is, and its UTF-8 repaired if repair is, or with write
+// off only works out the length it would write; invalid is set when some
+// byte was not well-formed UTF-8. where the
+// scan stops, the 16 bytes from there are handled from their masks, so text
+// dense with quotes or accents is not rescanned after every character; if
+// they are all ASCII, the escapes need no more than a count or a copy that
+// puts in a backslash wherever the mask has a bit
+template <bool write>
+size_t text_escape(char *out, const char *str, size_t length, bool shell, bool controls, bool repair, bool &invalid) {
+  const char *end = str + length;
+  size_t written = 0;
+  while (end - str >= 16) {
+    uint64_t high, mask = text_mask(str, shell, high);
+    if (!(mask | high)) {
+      // a clean block: leave the rest of the run to the wider scan
+      const char *next = text_scan(str + 16, end, shell);
+      if (write) memcpy(out + written, str, next - str);
+      written += next - str;
+      str = next;
+      continue;
+    }
+    if (!high) {
+      if (!write) {
+        written += 16 + __builtin_popcountll(mask) / text_mask_step;
+      } else {
+        for (unsigned i = 0; i < 16; i++) {
+          out[written] = '\\';
+          written += (mask >> (i * text_mask_step)) & 1;
+          out[written++] = str[i];
+        }
+      }
+      str += 16;
+      continue;
+    }
+    mask |= high;
+    size_t done = 0;
+    while (mask) {
+      size_t position = __builtin_ctzll(mask) / text_mask_step;
+      mask &= ~((((uint64_t)1 << text_mask_step) - 1) << (position * text_mask_step));
+      // a continuation byte of a sequence already taken
+      if (position < done) continue;
+      if (write) memcpy(out + written, str + done, position - done);
+      written += position - done;
+      done = position + text_put<write>(out, written, str + position, end, shell, controls, repair, invalid);
+    }
+    if (done < 16) {
+      if (write) memcpy(out + written, str + done, 16 - done);
+      written += 16 - done;
+      done = 16;
+    }
+    str += done;
+  }
+  while (str < end)
+    str += text_put<write>(out, written, str, end, shell, controls, repair, invalid);
+  return written;
+}
+
+size_t text_escape(char *out, const char *str, size_t length, bool shell, bool controls, bool repair, bool &invalid) {
+  if (out) return text_escape<true>(out, str, length, shell, controls, repair, invalid);
+  return text_escape<false>(out, str, length, shell, controls, repair, invalid);
+}
+
+// text handed to GTK or D-Bus as it is, repaired if that is turned on
+string utf8_text(const string &str) {
+  bool invalid = false;
+  bool repair = utf8_repair.load(std::memory_order_relaxed);
+  size_t length = text_escape(nullptr, str.data(), str.length(), false, false, repair, invalid);
+  if (!invalid) return str;
+  metrics_count(metric_invalid_utf8);
+  if (!repair) return str;
+  string result(length, '\0');
+  text_escape(&result[0], str.data(), str.length(), false, false, true, invalid);
+  return result;
+}
+
+bool file_exists(const string &fname) {
   struct stat sb;
   return (stat(fname.c_str(), &sb) == 0 &&
     S_ISREG(sb.st_mode) != 0);
@@ -217,19 +936,6 @@ string filename_ext(string fname) {
   return fname.substr(fp);
 }
 
-int XErrorHandlerImpl(Display *display, XErrorEvent *event) {
-  return 0;
-}
-
-int XIOErrorHandlerImpl(Display *display) {
-  return 0;
-}
-
-void SetErrorHandlers() {
-  XSetErrorHandler(XErrorHandlerImpl);
-  XSetIOErrorHandler(XIOErrorHandlerImpl);
-}
-
 window_t window_from_wid(wid_t wid) {
   return stoull(wid, nullptr, 10);
 }
@@ -239,19 +945,27 @@ wid_t wid_from_window(window_t window) {
 }
 
 process_t ppid_from_pid(process_t pid) {
-  process_t ppid;
+  process_t ppid = 0;
   #if defined (__APPLE__) && defined(__MACH__)
   proc_bsdinfo proc_info;
   if (proc_pidinfo(pid, PROC_PIDTBSDINFO, 0, &proc_info, sizeof(proc_info)) > 0) {
     ppid = proc_info.pbi_ppid;
   }
   #elif defined(__linux__) && !defined(__ANDROID__)
-  PROCTAB *proc = openproc(PROC_FILLSTATUS | PROC_PID, &pid);
-  if (proc_t *proc_info = readproc(proc, nullptr)) {
-    ppid = proc_info->ppid;
-    freeproc(proc_info);
+  // the field after the state in /proc/<pid>/stat; the command name before
+  // it is in parentheses and may hold spaces and parentheses of its own
+  char buffer[512];
+  string stat = string("/proc/") + to_string(pid) + string("/stat");
+  int fd = open(stat.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd != -1) {
+    ssize_t count = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (count > 0) {
+      buffer[count] = '\0';
+      if (char *end = strrchr(buffer, ')'))
+        sscanf(end + 1, " %*c %d", &ppid);
+    }
   }
-  closeproc(proc);
   #elif defined(__FreeBSD__)
   if (kinfo_proc *proc_info = kinfo_getproc(pid)) {
     ppid = proc_info->ki_ppid;
@@ -297,69 +1011,99 @@ string name_from_pid(process_t pid) {
   return fname.substr(fp + 1);
 }
 
-wid_t wid_from_top() {
-  SetErrorHandlers();
-  unsigned char *prop;
-  unsigned long property;
-  Atom actual_type, filter_atom;
-  int actual_format, status;
-  unsigned long nitems, bytes_after;
-  wid_t wid; Window window;
-  Display *display = XOpenDisplay(nullptr);
-  int screen = XDefaultScreen(display);
-  window = RootWindow(display, screen);
-  filter_atom = XInternAtom(display, "_NET_ACTIVE_WINDOW", true);
-  status = XGetWindowProperty(display, window, filter_atom, 0, 1000, false,
-  AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes_after, &prop);
-  if (status == Success && prop != nullptr) {
-    property = prop[0] + (prop[1] << 8) + (prop[2] << 16) + (prop[3] << 24);
-    XFree(prop);
-  }
-  wid = wid_from_window(property);
-  XCloseDisplay(display);
-  return wid;
-}
-
-process_t pid_from_wid(wid_t wid) {
-  SetErrorHandlers();
-  unsigned char *prop;
-  unsigned long property;
-  Atom actual_type, filter_atom;
-  int actual_format, status;
-  unsigned long nitems, bytes_after;
-  process_t pid; Window window;
-  window = window_from_wid(wid);
-  if (!window) return pid;
-  Display *display = XOpenDisplay(nullptr);
-  filter_atom = XInternAtom(display, "_NET_WM_PID", true);
-  status = XGetWindowProperty(display, window, filter_atom, 0, 1000, false,
-  AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes_after, &prop);
-  if (status == Success && prop != nullptr) {
-    property = prop[0] + (prop[1] << 8) + (prop[2] << 16) + (prop[3] << 24);
-    XFree(prop);
-  }
-  pid = property;
-  XCloseDisplay(display);
-  return pid;
+// the atoms the window helpers need, interned together so that costs one
+// round trip; an atom the server has never seen comes back as XCB_ATOM_NONE
+struct window_atoms {
+  xcb_atom_t active_window;
+  xcb_atom_t wm_pid;
+  xcb_atom_t wm_name;
+  xcb_atom_t wm_icon;
+  xcb_atom_t utf8_string;
+};
+
+window_atoms atoms_intern(xcb_connection_t *connection) {
+  const char *names[] = { "_NET_ACTIVE_WINDOW", "_NET_WM_PID", "_NET_WM_NAME", "_NET_WM_ICON", "UTF8_STRING" };
+  xcb_atom_t *atoms[] = { nullptr, nullptr, nullptr, nullptr, nullptr };
+  window_atoms result;
+  atoms[0] = &result.active_window;
+  atoms[1] = &result.wm_pid;
+  atoms[2] = &result.wm_name;
+  atoms[3] = &result.wm_icon;
+  atoms[4] = &result.utf8_string;
+  xcb_intern_atom_cookie_t cookies[5];
+  for (int i = 0; i < 5; i++)
+    cookies[i] = xcb.intern_atom(connection, true, strlen(names[i]), names[i]);
+  metrics_count(metric_atoms_interned, 5);
+  for (int i = 0; i < 5; i++) {
+    xcb_intern_atom_reply_t *reply = xcb.intern_atom_reply(connection, cookies[i], nullptr);
+    *atoms[i] = reply ? reply->atom : (xcb_atom_t)XCB_ATOM_NONE;
+    free(reply);
+  }
+  return result;
+}
+
+xcb_window_t root_window(xcb_connection_t *connection) {
+  xcb_screen_iterator_t it = xcb.setup_roots_iterator(xcb.get_setup(connection));
+  return it.rem ? it.data->root : (xcb_window_t)XCB_WINDOW_NONE;
+}
+
+// the first 32-bit item of a property, such as a window or a pid; 0 if unset
+uint32_t property_cardinal(xcb_connection_t *connection, xcb_window_t window, xcb_atom_t property) {
+  uint32_t result = 0;
+  if (!window || property == XCB_ATOM_NONE) return result;
+  xcb_get_property_reply_t *reply = xcb.get_property_reply(connection,
+    xcb.get_property(connection, false, window, property, XCB_GET_PROPERTY_TYPE_ANY, 0, 1), nullptr);
+  if (reply && reply->format == 32 && xcb.get_property_value_length(reply) >= 4)
+    result = *(uint32_t *)xcb.get_property_value(reply);
+  free(reply);
+  return result;
+}
+
+// the decorator looks for the dialog again whenever the active window
+// changes, and at least this often in case its process was not yet known
+std::chrono::milliseconds const active_window_poll(50);
+
+// asks for PropertyNotify on the root window, so active_window_wait() hears
+// of every change to _NET_ACTIVE_WINDOW
+void active_window_watch(xcb_connection_t *connection) {
+  uint32_t event_mask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+  xcb.change_window_attributes(connection, root_window(connection), XCB_CW_EVENT_MASK, &event_mask);
+  xcb.flush(connection);
+}
+
+// sleeps until the active window changes or active_window_poll has passed
+void active_window_wait(xcb_connection_t *connection, const window_atoms &atoms) {
+  pollfd pfd = { xcb.get_file_descriptor(connection), POLLIN, 0 };
+  std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + active_window_poll;
+  while (!xcb.connection_has_error(connection)) {
+    bool changed = false;
+    while (xcb_generic_event_t *event = xcb.poll_for_event(connection)) {
+      if ((event->response_type & 0x7f) == XCB_PROPERTY_NOTIFY &&
+        ((xcb_property_notify_event_t *)event)->atom == atoms.active_window)
+        changed = true;
+      free(event);
+    }
+    if (changed) return;
+    int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(until - std::chrono::steady_clock::now()).count();
+    if (left <= 0) return;
+    if (poll(&pfd, 1, left) == -1 && errno != EINTR) return;
+  }
+}
+
+wid_t wid_from_top(xcb_connection_t *connection, const window_atoms &atoms) {
+  return wid_from_window(property_cardinal(connection, root_window(connection), atoms.active_window));
 }
 
-void wid_to_top(wid_t wid) {
-  SetErrorHandlers();
-  unsigned long window = window_from_wid(wid);
-  Display *display = XOpenDisplay(nullptr);
-  XRaiseWindow(display, window);
-  XSetInputFocus(display, window, RevertToPointerRoot, CurrentTime);
-  XCloseDisplay(display);
+process_t pid_from_wid(xcb_connection_t *connection, const window_atoms &atoms, wid_t wid) {
+  return (process_t)property_cardinal(connection, (xcb_window_t)window_from_wid(wid), atoms.wm_pid);
 }
 
-void wid_set_pwid(wid_t wid, wid_t pwid) {
-  SetErrorHandlers();
+void wid_set_pwid(xcb_connection_t *connection, wid_t wid, wid_t pwid) {
   if (pwid == "-1") return;
-  Display *display = XOpenDisplay(nullptr);
-  unsigned long window = window_from_wid(wid);
-  unsigned long parent = stoul(pwid, nullptr, 10);
-  XSetTransientForHint(display, window, parent);
-  XCloseDisplay(display);
+  xcb_window_t window = (xcb_window_t)window_from_wid(wid);
+  xcb_window_t parent = (xcb_window_t)stoul(pwid, nullptr, 10);
+  xcb.change_property(connection, XCB_PROP_MODE_REPLACE, window, XCB_ATOM_WM_TRANSIENT_FOR,
+    XCB_ATOM_WINDOW, 32, 1, &parent);
 }
 
 bool WaitForChildPidOfPidToExist(process_t pid, process_t ppid) {
@@ -371,390 +1115,2755 @@ bool WaitForChildPidOfPidToExist(process_t pid, process_t ppid) {
   return (pid != ppid);
 }
 
-process_t modify_dialog(process_t ppid) {
-  process_t pid = 0;
-  if ((pid = fork()) == 0) {
-    SetErrorHandlers();
-    Display *display = XOpenDisplay(nullptr);
-    Window window, parent = owner ? (Window)owner : 
-      (Window)window_from_wid(wid_from_top());
-    string wid = wid_from_top();
-    process_t pid = pid_from_wid(wid);
-    while (WaitForChildPidOfPidToExist(pid, ppid) && 
-      name_from_pid(pid) != "zenity" && name_from_pid(pid) != "kdialog") {
-      wid = wid_from_top();
-      pid = pid_from_wid(wid);
-    }
-    wid_set_pwid(wid, wid_from_window((unsigned long)parent));
-    window = (Window)window_from_wid(wid);
-    Atom atom_name = XInternAtom(display,"_NET_WM_NAME", true);
-    Atom atom_utf_type = XInternAtom(display,"UTF8_STRING", true);
-    char *cstr_caption = (char *)caption.c_str();
-    XChangeProperty(display, window, atom_name, atom_utf_type, 8, 
-      PropModeReplace, (unsigned char *)cstr_caption, strlen(cstr_caption));
-    if (file_exists(current_icon) && filename_ext(current_icon) == ".png")
-      XSetIcon(display, window, current_icon.c_str());
-    XCloseDisplay(display);
-    exit(0);
-  }
-  return pid;
+// GTK 3 is opened with dlopen() the first time the "GTK" system is used, so
+// nothing links against it; the calls needed are declared here with opaque
+// pointers, and all of them are made on the one GUI thread that runs gtk_main()
+struct gtk_rgba {
+  double red;
+  double green;
+  double blue;
+  double alpha;
+};
+
+struct gtk_slist {
+  void *data;
+  gtk_slist *next;
+};
+
+struct gtk_tree_iter {
+  int stamp;
+  void *user_data[3];
+};
+
+// G_TYPE_STRING, a fundamental type number shifted left by two
+size_t const gtk_type_string = 16 << 2;
+
+int const gtk_response_accept = -3;
+int const gtk_response_ok     = -5;
+int const gtk_response_cancel = -6;
+
+struct gtk_api {
+  int (*init_check)(int *, char ***);
+  void (*main)();
+  unsigned (*idle_add)(int (*)(void *), void *);
+  void (*free)(void *);
+  void (*slist_free)(gtk_slist *);
+  void (*object_unref)(void *);
+  void *(*message_dialog_new)(void *, int, int, int, const char *, ...);
+  void *(*message_dialog_get_message_area)(void *);
+  void *(*dialog_add_button)(void *, const char *, int);
+  void (*dialog_set_default_response)(void *, int);
+  int (*dialog_run)(void *);
+  void (*widget_show)(void *);
+  void (*widget_destroy)(void *);
+  void (*window_set_title)(void *, const char *);
+  int (*window_set_icon_from_file)(void *, const char *, void **);
+  void (*window_set_keep_above)(void *, int);
+  void (*container_add)(void *, void *);
+  void *(*entry_new)();
+  void (*entry_set_text)(void *, const char *);
+  const char *(*entry_get_text)(void *);
+  void (*entry_set_visibility)(void *, int);
+  void (*entry_set_activates_default)(void *, int);
+  void *(*file_chooser_native_new)(const char *, void *, int, const char *, const char *);
+  int (*native_dialog_run)(void *);
+  void (*file_chooser_set_select_multiple)(void *, int);
+  void (*file_chooser_set_do_overwrite_confirmation)(void *, int);
+  int (*file_chooser_set_current_folder)(void *, const char *);
+  void (*file_chooser_set_current_name)(void *, const char *);
+  int (*file_chooser_set_filename)(void *, const char *);
+  char *(*file_chooser_get_filename)(void *);
+  gtk_slist *(*file_chooser_get_filenames)(void *);
+  void (*file_chooser_add_filter)(void *, void *);
+  void *(*file_filter_new)();
+  void (*file_filter_set_name)(void *, const char *);
+  void (*file_filter_add_pattern)(void *, const char *);
+  void *(*color_chooser_dialog_new)(const char *, void *);
+  void (*color_chooser_set_use_alpha)(void *, int);
+  void (*color_chooser_set_rgba)(void *, const gtk_rgba *);
+  void (*color_chooser_get_rgba)(void *, gtk_rgba *);
+  void *(*list_store_new)(int, ...);
+  void (*list_store_append)(void *, gtk_tree_iter *);
+  void (*list_store_set)(void *, gtk_tree_iter *, ...);
+  void (*tree_model_get)(void *, gtk_tree_iter *, ...);
+  void *(*tree_view_new_with_model)(void *);
+  int (*tree_view_insert_column_with_attributes)(void *, int, const char *, void *, ...);
+  void *(*tree_view_get_selection)(void *);
+  int (*tree_selection_get_selected)(void *, void **, gtk_tree_iter *);
+  void *(*cell_renderer_text_new)();
+  void *(*scrolled_window_new)(void *, void *);
+  void (*widget_set_size_request)(void *, int, int);
+};
+
+gtk_api gtk;
+std::mutex gtk_mutex;
+
+bool gtk_symbols(void *library) {
+  return library_symbol(library, "gtk_init_check", gtk.init_check) &&
+    library_symbol(library, "gtk_main", gtk.main) &&
+    library_symbol(library, "g_idle_add", gtk.idle_add) &&
+    library_symbol(library, "g_free", gtk.free) &&
+    library_symbol(library, "g_slist_free", gtk.slist_free) &&
+    library_symbol(library, "g_object_unref", gtk.object_unref) &&
+    library_symbol(library, "gtk_message_dialog_new", gtk.message_dialog_new) &&
+    library_symbol(library, "gtk_message_dialog_get_message_area", gtk.message_dialog_get_message_area) &&
+    library_symbol(library, "gtk_dialog_add_button", gtk.dialog_add_button) &&
+    library_symbol(library, "gtk_dialog_set_default_response", gtk.dialog_set_default_response) &&
+    library_symbol(library, "gtk_dialog_run", gtk.dialog_run) &&
+    library_symbol(library, "gtk_widget_show", gtk.widget_show) &&
+    library_symbol(library, "gtk_widget_destroy", gtk.widget_destroy) &&
+    library_symbol(library, "gtk_window_set_title", gtk.window_set_title) &&
+    library_symbol(library, "gtk_window_set_icon_from_file", gtk.window_set_icon_from_file) &&
+    library_symbol(library, "gtk_window_set_keep_above", gtk.window_set_keep_above) &&
+    library_symbol(library, "gtk_container_add", gtk.container_add) &&
+    library_symbol(library, "gtk_entry_new", gtk.entry_new) &&
+    library_symbol(library, "gtk_entry_set_text", gtk.entry_set_text) &&
+    library_symbol(library, "gtk_entry_get_text", gtk.entry_get_text) &&
+    library_symbol(library, "gtk_entry_set_visibility", gtk.entry_set_visibility) &&
+    library_symbol(library, "gtk_entry_set_activates_default", gtk.entry_set_activates_default) &&
+    library_symbol(library, "gtk_file_chooser_native_new", gtk.file_chooser_native_new) &&
+    library_symbol(library, "gtk_native_dialog_run", gtk.native_dialog_run) &&
+    library_symbol(library, "gtk_file_chooser_set_select_multiple", gtk.file_chooser_set_select_multiple) &&
+    library_symbol(library, "gtk_file_chooser_set_do_overwrite_confirmation", gtk.file_chooser_set_do_overwrite_confirmation) &&
+    library_symbol(library, "gtk_file_chooser_set_current_folder", gtk.file_chooser_set_current_folder) &&
+    library_symbol(library, "gtk_file_chooser_set_current_name", gtk.file_chooser_set_current_name) &&
+    library_symbol(library, "gtk_file_chooser_set_filename", gtk.file_chooser_set_filename) &&
+    library_symbol(library, "gtk_file_chooser_get_filename", gtk.file_chooser_get_filename) &&
+    library_symbol(library, "gtk_file_chooser_get_filenames", gtk.file_chooser_get_filenames) &&
+    library_symbol(library, "gtk_file_chooser_add_filter", gtk.file_chooser_add_filter) &&
+    library_symbol(library, "gtk_file_filter_new", gtk.file_filter_new) &&
+    library_symbol(library, "gtk_file_filter_set_name", gtk.file_filter_set_name) &&
+    library_symbol(library, "gtk_file_filter_add_pattern", gtk.file_filter_add_pattern) &&
+    library_symbol(library, "gtk_color_chooser_dialog_new", gtk.color_chooser_dialog_new) &&
+    library_symbol(library, "gtk_color_chooser_set_use_alpha", gtk.color_chooser_set_use_alpha) &&
+    library_symbol(library, "gtk_color_chooser_set_rgba", gtk.color_chooser_set_rgba) &&
+    library_symbol(library, "gtk_color_chooser_get_rgba", gtk.color_chooser_get_rgba) &&
+    library_symbol(library, "gtk_list_store_new", gtk.list_store_new) &&
+    library_symbol(library, "gtk_list_store_append", gtk.list_store_append) &&
+    library_symbol(library, "gtk_list_store_set", gtk.list_store_set) &&
+    library_symbol(library, "gtk_tree_model_get", gtk.tree_model_get) &&
+    library_symbol(library, "gtk_tree_view_new_with_model", gtk.tree_view_new_with_model) &&
+    library_symbol(library, "gtk_tree_view_insert_column_with_attributes", gtk.tree_view_insert_column_with_attributes) &&
+    library_symbol(library, "gtk_tree_view_get_selection", gtk.tree_view_get_selection) &&
+    library_symbol(library, "gtk_tree_selection_get_selected", gtk.tree_selection_get_selected) &&
+    library_symbol(library, "gtk_cell_renderer_text_new", gtk.cell_renderer_text_new) &&
+    library_symbol(library, "gtk_scrolled_window_new", gtk.scrolled_window_new) &&
+    library_symbol(library, "gtk_widget_set_size_request", gtk.widget_set_size_request);
 }
 
-string shellscript_evaluate(string command) {
-  char *buffer = nullptr;
-  size_t buffer_size = 0;
-  string str_buffer;
-  FILE *file = popen(command.c_str(), "r");
-  process_t ppid = getpid();
-  process_t pid = modify_dialog(ppid);
-  while (getline(&buffer, &buffer_size, file) != -1)
-    str_buffer += buffer;
-  free(buffer);
-  pclose(file);
-  kill(pid, SIGTERM);
-  bool died = false;
-  for (unsigned i = 0; !died && i < 4; i++) {
-    int status; 
-    std::this_thread::sleep_for(std::chrono::milliseconds(250));
-    if (waitpid(pid, &status, WNOHANG) == pid) died = true;
-  }
-  if (!died) kill(pid, SIGKILL);
-  if (str_buffer[str_buffer.length() - 1] == '\n')
-    str_buffer.pop_back();
-  return str_buffer;
+// true once GTK is loaded and its GUI thread is up; only tried once
+bool gtk_load() {
+  static std::once_flag gtk_flag;
+  static bool gtk_loaded = false;
+  std::call_once(gtk_flag, []() {
+    void *library = dlopen("libgtk-3.so.0", RTLD_NOW | RTLD_LOCAL);
+    if (!library || !gtk_symbols(library)) return;
+    std::promise<bool> initialized;
+    std::future<bool> result = initialized.get_future();
+    std::thread([&initialized]() {
+      bool success = gtk.init_check(nullptr, nullptr);
+      initialized.set_value(success);
+      if (success) gtk.main();
+    }).detach();
+    gtk_loaded = result.get();
+  });
+  return gtk_loaded;
 }
 
-string add_escaping(string str, bool is_caption, string new_caption) {
-  string result = str; if (is_caption && str == "") result = new_caption;
-  result = string_replace_all(result, "\"", "\\\"");
-  return result;
+// runs job on the GUI thread and waits for it; one dialog at a time, so a
+// nested dialog_run() loop never picks up another caller's dialog
+void gtk_invoke(std::function<void()> job) {
+  struct gtk_call {
+    std::function<void()> job;
+    std::promise<void> done;
+  } call;
+  call.job = job;
+  std::future<void> done = call.done.get_future();
+  std::lock_guard<std::mutex> lock(gtk_mutex);
+  gtk.idle_add([](void *data) -> int {
+    gtk_call *call = (gtk_call *)data;
+    call->job();
+    call->done.set_value();
+    return 0;
+  }, &call);
+  done.wait();
 }
 
-string remove_trailing_zeros(double numb) {
-  string strnumb = std::to_string(numb);
+// the desktop portal's FileChooser is reached over the session bus through
+// libdbus, opened with dlopen() like GTK; the portal thread owns the private
+// connection and moves every request from queued to sent, to waiting once
+// the Request object it answers on is known, and to done when the Response
+// signal comes, or to failed so the shell engine can take the dialog instead
+struct dbus_iter {
+  // DBusMessageIter is a handful of pointers and ints; this is larger
+  void *storage[16];
+};
 
-  while (!strnumb.empty() && strnumb.find('.') != string::npos && (strnumb.back() == '.' || strnumb.back() == '0'))
-    strnumb.pop_back();
+int const dbus_bus_session           = 0;
+int const dbus_message_method_return = 2;
+int const dbus_message_error         = 3;
+int const dbus_handler_handled       = 0;
+int const dbus_handler_not_yet       = 1;
+int const dbus_data_remains          = 0;
+
+struct dbus_api {
+  void *(*bus_get_private)(int, void *);
+  const char *(*bus_get_unique_name)(void *);
+  void (*bus_add_match)(void *, const char *, void *);
+  void (*connection_set_exit_on_disconnect)(void *, unsigned);
+  unsigned (*connection_add_filter)(void *, int (*)(void *, void *, void *), void *, void (*)(void *));
+  unsigned (*connection_get_unix_fd)(void *, int *);
+  unsigned (*connection_read_write_dispatch)(void *, int);
+  int (*connection_get_dispatch_status)(void *);
+  int (*connection_dispatch)(void *);
+  unsigned (*connection_send)(void *, void *, uint32_t *);
+  void (*connection_flush)(void *);
+  void (*connection_close)(void *);
+  void (*connection_unref)(void *);
+  void *(*message_new_method_call)(const char *, const char *, const char *, const char *);
+  void (*message_unref)(void *);
+  int (*message_get_type)(void *);
+  uint32_t (*message_get_reply_serial)(void *);
+  unsigned (*message_is_signal)(void *, const char *, const char *);
+  const char *(*message_get_path)(void *);
+  unsigned (*message_iter_init)(void *, dbus_iter *);
+  void (*message_iter_init_append)(void *, dbus_iter *);
+  int (*message_iter_get_arg_type)(dbus_iter *);
+  void (*message_iter_get_basic)(dbus_iter *, void *);
+  unsigned (*message_iter_next)(dbus_iter *);
+  void (*message_iter_recurse)(dbus_iter *, dbus_iter *);
+  unsigned (*message_iter_append_basic)(dbus_iter *, int, const void *);
+  unsigned (*message_iter_append_fixed_array)(dbus_iter *, int, const void *, int);
+  unsigned (*message_iter_open_container)(dbus_iter *, int, const char *, dbus_iter *);
+  unsigned (*message_iter_close_container)(dbus_iter *, dbus_iter *);
+  void (*message_set_no_reply)(void *, unsigned);
+};
 
-  return strnumb;
+dbus_api dbus;
+
+bool dbus_symbols(void *library) {
+  return library_symbol(library, "dbus_bus_get_private", dbus.bus_get_private) &&
+    library_symbol(library, "dbus_bus_get_unique_name", dbus.bus_get_unique_name) &&
+    library_symbol(library, "dbus_bus_add_match", dbus.bus_add_match) &&
+    library_symbol(library, "dbus_connection_set_exit_on_disconnect", dbus.connection_set_exit_on_disconnect) &&
+    library_symbol(library, "dbus_connection_add_filter", dbus.connection_add_filter) &&
+    library_symbol(library, "dbus_connection_get_unix_fd", dbus.connection_get_unix_fd) &&
+    library_symbol(library, "dbus_connection_read_write_dispatch", dbus.connection_read_write_dispatch) &&
+    library_symbol(library, "dbus_connection_get_dispatch_status", dbus.connection_get_dispatch_status) &&
+    library_symbol(library, "dbus_connection_dispatch", dbus.connection_dispatch) &&
+    library_symbol(library, "dbus_connection_send", dbus.connection_send) &&
+    library_symbol(library, "dbus_connection_flush", dbus.connection_flush) &&
+    library_symbol(library, "dbus_connection_close", dbus.connection_close) &&
+    library_symbol(library, "dbus_connection_unref", dbus.connection_unref) &&
+    library_symbol(library, "dbus_message_new_method_call", dbus.message_new_method_call) &&
+    library_symbol(library, "dbus_message_unref", dbus.message_unref) &&
+    library_symbol(library, "dbus_message_get_type", dbus.message_get_type) &&
+    library_symbol(library, "dbus_message_get_reply_serial", dbus.message_get_reply_serial) &&
+    library_symbol(library, "dbus_message_is_signal", dbus.message_is_signal) &&
+    library_symbol(library, "dbus_message_get_path", dbus.message_get_path) &&
+    library_symbol(library, "dbus_message_iter_init", dbus.message_iter_init) &&
+    library_symbol(library, "dbus_message_iter_init_append", dbus.message_iter_init_append) &&
+    library_symbol(library, "dbus_message_iter_get_arg_type", dbus.message_iter_get_arg_type) &&
+    library_symbol(library, "dbus_message_iter_get_basic", dbus.message_iter_get_basic) &&
+    library_symbol(library, "dbus_message_iter_next", dbus.message_iter_next) &&
+    library_symbol(library, "dbus_message_iter_recurse", dbus.message_iter_recurse) &&
+    library_symbol(library, "dbus_message_iter_append_basic", dbus.message_iter_append_basic) &&
+    library_symbol(library, "dbus_message_iter_append_fixed_array", dbus.message_iter_append_fixed_array) &&
+    library_symbol(library, "dbus_message_iter_open_container", dbus.message_iter_open_container) &&
+    library_symbol(library, "dbus_message_iter_close_container", dbus.message_iter_close_container) &&
+    library_symbol(library, "dbus_message_set_no_reply", dbus.message_set_no_reply);
 }
 
-string zenity_filter(string input) {
-  input = string_replace_all(input, "\r", "");
-  input = string_replace_all(input, "\n", "");
-  std::vector<string> stringVec = string_split(input, '|');
-  string string_output = "";
+enum PORTAL_STATES {
+  PORTAL_QUEUED,
+  PORTAL_SENT,
+  PORTAL_WAITING,
+  PORTAL_DONE,
+  PORTAL_FAILED
+};
 
-  unsigned index = 0;
-  for (string str : stringVec) {
-    if (index % 2 == 0)
-      string_output += string(" --file-filter=\"") + 
-        add_escaping(string_replace_all(str, "*.*", "*"), false, "") + string("|");
-    else {
-      std::replace(str.begin(), str.end(), ';', ' ');
-      string_output += add_escaping(string_replace_all(str, "*.*", "*"), false, "") + string("\"");
-    }
+typedef vector<std::pair<string, vector<string>>> filter_list;
+
+struct portal_request {
+  int state = PORTAL_QUEUED;
+  string method;
+  string parent;
+  string title;
+  bool multiple = false;
+  bool directory = false;
+  filter_list filters;
+  string current_name;
+  string current_folder;
+  string current_file;
+  // the Request object path the Response signal is sent from
+  string path;
+  uint32_t serial = 0;
+  uint32_t response = 2;
+  vector<string> uris;
+};
 
-    index += 1;
-  }
+struct portal_state {
+  void *connection = nullptr;
+  int wake[2] = { -1, -1 };
+  // the unique bus name the way it appears in Request object paths
+  string sender;
+  unsigned tokens = 0;
+  vector<portal_request *> queued;
+  std::map<uint32_t, portal_request *> by_serial;
+  std::map<string, portal_request *> by_path;
+  // messages nobody waits on an answer to, such as notifications
+  vector<void *> outgoing;
+};
 
-  return string_output;
+portal_state portal;
+std::mutex portal_mutex;
+std::condition_variable portal_changed;
+
+void portal_append_option(dbus_iter *options, const char *key, const char *signature,
+  const std::function<void(dbus_iter *)> &append) {
+  dbus_iter entry, variant;
+  dbus.message_iter_open_container(options, 'e', nullptr, &entry);
+  dbus.message_iter_append_basic(&entry, 's', &key);
+  dbus.message_iter_open_container(&entry, 'v', signature, &variant);
+  append(&variant);
+  dbus.message_iter_close_container(&entry, &variant);
+  dbus.message_iter_close_container(options, &entry);
 }
 
-string kdialog_filter(string input) {
-  input = string_replace_all(input, "\r", "");
-  input = string_replace_all(input, "\n", "");
-  std::vector<string> stringVec = string_split(input, '|');
-  string string_output = " \"";
+void portal_append_bytes(dbus_iter *variant, const string &str) {
+  // paths go as nul-terminated byte arrays
+  dbus_iter bytes;
+  const char *data = str.c_str();
+  dbus.message_iter_open_container(variant, 'a', "y", &bytes);
+  dbus.message_iter_append_fixed_array(&bytes, 'y', &data, (int)str.length() + 1);
+  dbus.message_iter_close_container(variant, &bytes);
+}
 
-  unsigned index = 0;
-  for (string str : stringVec) {
-    if (index % 2 == 0) {
-      if (index != 0)
-        string_output += "\n";
-      size_t first = str.find('(');
-      if (first != string::npos) {
-        size_t last = str.find(')', first);
-        if (last != string::npos)
-          str.erase(first, last - first + 1);
+// called with portal_mutex held, on the portal thread
+void portal_send(portal_request *request) {
+  string token = string("dlgmod") + to_string(++portal.tokens);
+  request->path = string("/org/freedesktop/portal/desktop/request/") + portal.sender + string("/") + token;
+  void *message = dbus.message_new_method_call("org.freedesktop.portal.Desktop",
+    "/org/freedesktop/portal/desktop", "org.freedesktop.portal.FileChooser", request->method.c_str());
+  if (!message) {
+    request->state = PORTAL_FAILED;
+    return;
+  }
+  dbus_iter args, options;
+  const char *parent = request->parent.c_str();
+  const char *title = request->title.c_str();
+  dbus.message_iter_init_append(message, &args);
+  dbus.message_iter_append_basic(&args, 's', &parent);
+  dbus.message_iter_append_basic(&args, 's', &title);
+  dbus.message_iter_open_container(&args, 'a', "{sv}", &options);
+  portal_append_option(&options, "handle_token", "s", [&token](dbus_iter *variant) {
+    const char *str = token.c_str();
+    dbus.message_iter_append_basic(variant, 's', &str);
+  });
+  portal_append_option(&options, "modal", "b", [](dbus_iter *variant) {
+    unsigned value = 1;
+    dbus.message_iter_append_basic(variant, 'b', &value);
+  });
+  if (request->multiple || request->directory) {
+    portal_append_option(&options, request->multiple ? "multiple" : "directory", "b", [](dbus_iter *variant) {
+      unsigned value = 1;
+      dbus.message_iter_append_basic(variant, 'b', &value);
+    });
+  }
+  if (!request->filters.empty()) {
+    portal_append_option(&options, "filters", "a(sa(us))", [request](dbus_iter *variant) {
+      dbus_iter list, filter, patterns, pattern;
+      dbus.message_iter_open_container(variant, 'a', "(sa(us))", &list);
+      for (const std::pair<string, vector<string>> &item : request->filters) {
+        const char *name = item.first.c_str();
+        dbus.message_iter_open_container(&list, 'r', nullptr, &filter);
+        dbus.message_iter_append_basic(&filter, 's', &name);
+        dbus.message_iter_open_container(&filter, 'a', "(us)", &patterns);
+        for (const string &str : item.second) {
+          // 0 is a glob pattern, 1 a MIME type
+          unsigned kind = 0;
+          const char *glob = str.c_str();
+          dbus.message_iter_open_container(&patterns, 'r', nullptr, &pattern);
+          dbus.message_iter_append_basic(&pattern, 'u', &kind);
+          dbus.message_iter_append_basic(&pattern, 's', &glob);
+          dbus.message_iter_close_container(&patterns, &pattern);
+        }
+        dbus.message_iter_close_container(&filter, &patterns);
+        dbus.message_iter_close_container(&list, &filter);
       }
-      string_output += add_escaping(str, false, "") + string(" (");
-    } else {
-      std::replace(str.begin(), str.end(), ';', ' ');
-      string_output += add_escaping(string_replace_all(str, "*.*", "*"), false, "") + string(")");
-    }
-
-    index += 1;
+      dbus.message_iter_close_container(variant, &list);
+    });
   }
-
-  string_output += "\"";
-  return string_output;
+  if (request->current_name != "") {
+    portal_append_option(&options, "current_name", "s", [request](dbus_iter *variant) {
+      const char *str = request->current_name.c_str();
+      dbus.message_iter_append_basic(variant, 's', &str);
+    });
+  }
+  if (request->current_folder != "") {
+    portal_append_option(&options, "current_folder", "ay", [request](dbus_iter *variant) {
+      portal_append_bytes(variant, request->current_folder);
+    });
+  }
+  if (request->current_file != "") {
+    portal_append_option(&options, "current_file", "ay", [request](dbus_iter *variant) {
+      portal_append_bytes(variant, request->current_file);
+    });
+  }
+  dbus.message_iter_close_container(&args, &options);
+  if (dbus.connection_send(portal.connection, message, &request->serial)) {
+    request->state = PORTAL_SENT;
+    portal.by_serial[request->serial] = request;
+    portal.by_path[request->path] = request;
+  } else {
+    request->state = PORTAL_FAILED;
+  }
+  dbus.message_unref(message);
 }
 
-int color_get_red(int col) { return ((col & 0x000000FF)); }
-int color_get_green(int col) { return ((col & 0x0000FF00) >> 8); }
-int color_get_blue(int col) { return ((col & 0x00FF0000) >> 16); }
-
-int make_color_rgb(unsigned char r, unsigned char g, unsigned char b) {
-  return r | (g << 8) | (b << 16);
+// Response(u response, a{sv} results); only "uris" is used from the results
+void portal_read_response(void *message, portal_request *request) {
+  dbus_iter args, results, entry, value, uris;
+  if (!dbus.message_iter_init(message, &args) || dbus.message_iter_get_arg_type(&args) != 'u') return;
+  dbus.message_iter_get_basic(&args, &request->response);
+  if (!dbus.message_iter_next(&args) || dbus.message_iter_get_arg_type(&args) != 'a') return;
+  dbus.message_iter_recurse(&args, &results);
+  while (dbus.message_iter_get_arg_type(&results) == 'e') {
+    const char *key = nullptr;
+    dbus.message_iter_recurse(&results, &entry);
+    dbus.message_iter_get_basic(&entry, &key);
+    dbus.message_iter_next(&entry);
+    dbus.message_iter_recurse(&entry, &value);
+    if (strcmp(key, "uris") == 0 && dbus.message_iter_get_arg_type(&value) == 'a') {
+      dbus.message_iter_recurse(&value, &uris);
+      while (dbus.message_iter_get_arg_type(&uris) == 's') {
+        const char *uri = nullptr;
+        dbus.message_iter_get_basic(&uris, &uri);
+        request->uris.push_back(uri);
+        dbus.message_iter_next(&uris);
+      }
+    }
+    dbus.message_iter_next(&results);
+  }
 }
 
-int show_message_helperfunc(char *str) {  
-  change_relative_to_kwin();
-  string str_command;
-  string str_title = message_cancel ? add_escaping(caption, true, "Question") : add_escaping(caption, true, "Information");
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
-  string caption_previous = caption;
-  caption = (str_title == "Information") ? "Information" : caption;
-  caption = (str_title == "Question") ? "Question" : caption;
-
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
+// called with portal_mutex held; the request is out of both tables after this
+void portal_finish(portal_request *request, int state) {
+  portal.by_serial.erase(request->serial);
+  portal.by_path.erase(request->path);
+  request->state = state;
+  portal_changed.notify_all();
+}
 
-  string str_cancel;
-  string str_echo = "echo 1";
+int portal_filter(void *, void *message, void *) {
+  std::lock_guard<std::mutex> lock(portal_mutex);
+  int type = dbus.message_get_type(message);
+  if (type == dbus_message_method_return || type == dbus_message_error) {
+    auto it = portal.by_serial.find(dbus.message_get_reply_serial(message));
+    if (it == portal.by_serial.end()) return dbus_handler_not_yet;
+    portal_request *request = it->second;
+    portal.by_serial.erase(it);
+    if (type == dbus_message_error) {
+      portal_finish(request, PORTAL_FAILED);
+      return dbus_handler_handled;
+    }
+    // portals older than handle_token answer on a path of their own choosing
+    dbus_iter args;
+    const char *handle = nullptr;
+    if (dbus.message_iter_init(message, &args) && dbus.message_iter_get_arg_type(&args) == 'o')
+      dbus.message_iter_get_basic(&args, &handle);
+    if (handle && request->path != handle) {
+      portal.by_path.erase(request->path);
+      request->path = handle;
+      portal.by_path[request->path] = request;
+    }
+    if (request->state == PORTAL_SENT) request->state = PORTAL_WAITING;
+    return dbus_handler_handled;
+  }
+  if (dbus.message_is_signal(message, "org.freedesktop.portal.Request", "Response")) {
+    const char *path = dbus.message_get_path(message);
+    auto it = portal.by_path.find(path ? path : "");
+    if (it == portal.by_path.end()) return dbus_handler_not_yet;
+    portal_request *request = it->second;
+    portal_read_response(message, request);
+    portal_finish(request, PORTAL_DONE);
+    return dbus_handler_handled;
+  }
+  return dbus_handler_not_yet;
+}
+
+void portal_thread(void *connection, int fd) {
+  for (;;) {
+    struct pollfd fds[2] = { { fd, POLLIN, 0 }, { portal.wake[0], POLLIN, 0 } };
+    if (poll(fds, 2, -1) == -1 && errno != EINTR) break;
+    if (fds[1].revents & POLLIN) {
+      char buffer[64];
+      while (read(portal.wake[0], buffer, sizeof(buffer)) > 0);
+    }
+    {
+      std::lock_guard<std::mutex> lock(portal_mutex);
+      for (portal_request *request : portal.queued) {
+        portal_send(request);
+        if (request->state == PORTAL_FAILED) portal_changed.notify_all();
+      }
+      portal.queued.clear();
+      for (void *message : portal.outgoing) {
+        dbus.connection_send(connection, message, nullptr);
+        dbus.message_unref(message);
+      }
+      portal.outgoing.clear();
+    }
+    dbus.connection_flush(connection);
+    if (!dbus.connection_read_write_dispatch(connection, 0)) break;
+    while (dbus.connection_get_dispatch_status(connection) == dbus_data_remains)
+      dbus.connection_dispatch(connection);
+  }
+  // the bus went away; whatever is still open goes back to the shell engine
+  std::lock_guard<std::mutex> lock(portal_mutex);
+  portal.connection = nullptr;
+  for (portal_request *request : portal.queued)
+    request->state = PORTAL_FAILED;
+  portal.queued.clear();
+  for (void *message : portal.outgoing)
+    dbus.message_unref(message);
+  portal.outgoing.clear();
+  while (!portal.by_serial.empty())
+    portal_finish(portal.by_serial.begin()->second, PORTAL_FAILED);
+  while (!portal.by_path.empty())
+    portal_finish(portal.by_path.begin()->second, PORTAL_FAILED);
+  portal_changed.notify_all();
+  dbus.connection_close(connection);
+  dbus.connection_unref(connection);
+}
+
+// true once the session bus is connected and the portal thread is up; only
+// tried once, whether the portal itself answers is found out per request
+bool portal_load() {
+  static std::once_flag portal_flag;
+  static bool portal_loaded = false;
+  std::call_once(portal_flag, []() {
+    void *library = dlopen("libdbus-1.so.3", RTLD_NOW | RTLD_LOCAL);
+    if (!library || !dbus_symbols(library)) return;
+    void *connection = dbus.bus_get_private(dbus_bus_session, nullptr);
+    if (!connection) return;
+    int fd = -1;
+    dbus.connection_set_exit_on_disconnect(connection, false);
+    if (!dbus.connection_get_unix_fd(connection, &fd) || pipe2(portal.wake, O_CLOEXEC | O_NONBLOCK) == -1) {
+      dbus.connection_close(connection);
+      dbus.connection_unref(connection);
+      return;
+    }
+    string sender = dbus.bus_get_unique_name(connection);
+    sender = string_replace_all(sender.substr(sender.find_first_not_of(':')), ".", "_");
+    dbus.bus_add_match(connection, "type='signal',interface='org.freedesktop.portal.Request',member='Response'", nullptr);
+    dbus.connection_add_filter(connection, portal_filter, nullptr, nullptr);
+    portal.connection = connection;
+    portal.sender = sender;
+    std::thread(portal_thread, connection, fd).detach();
+    portal_loaded = true;
+  });
+  return portal_loaded;
+}
+
+// hands the portal thread a message to send and let go of
+bool portal_post(void *message) {
+  std::lock_guard<std::mutex> lock(portal_mutex);
+  char wake = 0;
+  if (!portal.connection || (write(portal.wake[1], &wake, 1) == -1 && errno != EAGAIN)) {
+    dbus.message_unref(message);
+    return false;
+  }
+  portal.outgoing.push_back(message);
+  return true;
+}
+
+// KWin detection for the dialogs the GTK and portal engines do not take, done once
+int fallback_engine() {
+  static int engine = change_relative_to_kwin(dm_x11);
+  return engine;
+}
+
+dialog_context capture_context(const char *title, const char *def) {
+  std::shared_ptr<const dialog_settings> current = settings_snapshot();
+  dialog_context ctx;
+  bool in_process = (current->engine == dm_gtk || current->engine == dm_portal);
+  ctx.mock = (current->engine == dm_mock);
+  ctx.engine = ctx.mock ? dm_zenity : in_process ? fallback_engine() : change_relative_to_kwin(current->engine);
+  ctx.gtk = (current->engine == dm_gtk && gtk_load());
+  ctx.portal = (current->engine == dm_portal && portal_load());
+  string str_title = title ? title : current->caption;
+  ctx.owner = current->owner;
+  ctx.caption = (str_title == "") ? def : str_title;
+  ctx.icon = (current->current_icon == "") ? filename_absolute("assets/icon.png") : current->current_icon;
+  for (int i = 0; i < btn_array_len; i++)
+    ctx.btn_array[i] = current->btn_array[i];
+  // the shell engines get theirs checked as their commands are built
+  if (ctx.gtk || ctx.portal) {
+    ctx.caption = utf8_text(ctx.caption);
+    for (int i = 0; i < btn_array_len; i++)
+      ctx.btn_array[i] = utf8_text(ctx.btn_array[i]);
+  }
+  return ctx;
+}
+
+// tracing: every phase of a shell dialog is a span in a ring owned by the
+// thread that ran it, so recording is a few relaxed stores and never locks;
+// with tracing off a span only goes into the metrics histograms.
+// dialog_trace_dump() writes whatever the rings still hold as
+// Chrome/Perfetto trace JSON
+std::atomic<bool> trace_enabled(false);
+unsigned const trace_capacity = 1024;
+
+struct trace_span {
+  std::atomic<const char *> name{nullptr};
+  std::atomic<uint64_t> start{0};
+  std::atomic<uint64_t> end{0};
+  std::atomic<uint32_t> pid{0};
+  std::atomic<uint32_t> tid{0};
+};
+
+// written only by the thread holding it, read by dialog_trace_dump(); a slot
+// is trusted once head has moved past it and not yet come back around
+struct trace_ring {
+  std::atomic<uint64_t> head{0};
+  trace_span spans[trace_capacity];
+};
+
+std::mutex trace_mutex;
+vector<trace_ring *> trace_rings;
+vector<trace_ring *> trace_free;
+std::atomic<uint32_t> trace_threads(0);
+
+uint64_t trace_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// rings outlive their threads so their spans can still be dumped, and go
+// back on the free list for the next thread that traces
+struct trace_owner {
+  trace_ring *ring = nullptr;
+  uint32_t tid = 0;
+  ~trace_owner() {
+    if (!ring) return;
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_free.push_back(ring);
+  }
+};
+
+void trace_record(const char *name, uint64_t start, uint64_t end, uint32_t pid = 0, uint32_t tid = 0) {
+  thread_local trace_owner owner;
+  if (!owner.ring) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    if (!trace_free.empty()) {
+      owner.ring = trace_free.back();
+      trace_free.pop_back();
+    } else {
+      owner.ring = new trace_ring;
+      trace_rings.push_back(owner.ring);
+    }
+    owner.tid = ++trace_threads;
+  }
+  uint64_t head = owner.ring->head.load(std::memory_order_relaxed);
+  trace_span &span = owner.ring->spans[head % trace_capacity];
+  span.name.store(name, std::memory_order_relaxed);
+  span.start.store(start, std::memory_order_relaxed);
+  span.end.store(end, std::memory_order_relaxed);
+  span.pid.store(pid ? pid : (uint32_t)getpid(), std::memory_order_relaxed);
+  span.tid.store(tid ? tid : owner.tid, std::memory_order_relaxed);
+  owner.ring->head.store(head + 1, std::memory_order_release);
+}
+
+struct trace_scope {
+  trace_phase phase;
+  uint64_t start;
+  trace_scope(trace_phase phase) : phase(phase), start(trace_now()) { }
+  ~trace_scope() {
+    uint64_t end = trace_now();
+    metrics_observe(phase, end - start);
+    if (trace_enabled.load(std::memory_order_relaxed))
+      trace_record(trace_phase_names[phase], start, end);
+  }
+};
+
+// the decorator is a forked child, so it leaves its timestamps in a shared
+// page that modify_dialog_reap() turns into spans on the child's own track
+struct decorator_times {
+  std::atomic<uint64_t> start{0};
+  std::atomic<uint64_t> found{0};
+  std::atomic<uint64_t> decorated{0};
+};
+
+std::mutex decorator_mutex;
+std::map<process_t, decorator_times *> decorator_traces;
+
+decorator_times *decorator_times_map() {
+  if (!trace_enabled.load(std::memory_order_relaxed)) return nullptr;
+  void *page = mmap(nullptr, sizeof(decorator_times), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  return (page == MAP_FAILED) ? nullptr : new (page) decorator_times;
+}
+
+void decorator_times_record(process_t pid) {
+  decorator_times *times = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(decorator_mutex);
+    auto it = decorator_traces.find(pid);
+    if (it == decorator_traces.end()) return;
+    times = it->second;
+    decorator_traces.erase(it);
+  }
+  uint64_t start = times->start.load(), found = times->found.load(), decorated = times->decorated.load();
+  if (start && found) trace_record(trace_phase_names[phase_discover], start, found, pid, pid);
+  if (found && decorated) trace_record(trace_phase_names[phase_decorate], found, decorated, pid, pid);
+  munmap(times, sizeof(decorator_times));
+}
+
+// the user's part of a dialog: until the engine has its answer to write, or
+// exits without one
+void trace_wait(int fd) {
+  trace_scope scope(phase_wait);
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  while (poll(&pfd, 1, -1) == -1 && errno == EINTR);
+}
+
+// the decorator keeps none of the caller's descriptors, or it would hold
+// open the write end of a pipe the dialog is waiting to see closed
+void descriptors_close_from(int lowfd) {
+  #if defined(__FreeBSD__)
+  closefrom(lowfd);
+  #else
+  #if defined(__linux__) && defined(SYS_close_range)
+  if (syscall(SYS_close_range, lowfd, ~0u, 0) == 0) return;
+  #endif
+  long maxfd = sysconf(_SC_OPEN_MAX);
+  if (maxfd < 0 || maxfd > 65536) maxfd = 65536;
+  for (int fd = lowfd; fd < maxfd; fd++) close(fd);
+  #endif
+}
+
+// the child waits for the dialog to become the active window, then queues
+// the parent, caption and icon changes and sends them in a single flush
+process_t modify_dialog(process_t ppid, const dialog_context &ctx) {
+  process_t pid = 0;
+  // loaded here rather than in the child, dlopen() is not safe after fork()
+  if (!xcb_load()) return pid;
+  decorator_times *times = decorator_times_map();
+  metrics();
+  if ((pid = fork()) == 0) {
+    uint64_t start = trace_now(), found;
+    if (times) times->start = start;
+    descriptors_close_from(STDERR_FILENO + 1);
+    counter_thread_forget();
+    xcb_connection_t *connection = xcb.connect(nullptr, nullptr);
+    if (xcb.connection_has_error(connection)) {
+      xcb.disconnect(connection);
+      _exit(0);
+    }
+    metrics_count(metric_x_connections);
+    xcb.prefetch_maximum_request_length(connection);
+    window_atoms atoms = atoms_intern(connection);
+    active_window_watch(connection);
+    xcb_window_t window, parent = ctx.owner ? ctx.owner :
+      (xcb_window_t)window_from_wid(wid_from_top(connection, atoms));
+    string wid = wid_from_top(connection, atoms);
+    process_t pid = pid_from_wid(connection, atoms, wid);
+    while (WaitForChildPidOfPidToExist(pid, ppid) ||
+      (name_from_pid(pid) != "zenity" && name_from_pid(pid) != "kdialog")) {
+      if (xcb.connection_has_error(connection)) _exit(0);
+      active_window_wait(connection, atoms);
+      wid = wid_from_top(connection, atoms);
+      pid = pid_from_wid(connection, atoms, wid);
+    }
+    found = trace_now();
+    metrics_observe(phase_discover, found - start);
+    DLGMOD_PROBE2(window__discovered, (int)pid, (unsigned long)window_from_wid(wid));
+    if (times) times->found = found;
+    wid_set_pwid(connection, wid, wid_from_window(parent));
+    window = (xcb_window_t)window_from_wid(wid);
+    if (atoms.wm_name != XCB_ATOM_NONE && atoms.utf8_string != XCB_ATOM_NONE)
+      xcb.change_property(connection, XCB_PROP_MODE_REPLACE, window, atoms.wm_name, atoms.utf8_string, 8,
+        ctx.caption.length(), ctx.caption.c_str());
+    if (file_exists(ctx.icon) && filename_ext(ctx.icon) == ".png")
+      window_set_icon(connection, window, atoms.wm_icon, ctx.icon.c_str());
+    xcb.flush(connection);
+    uint64_t decorated = trace_now();
+    metrics_observe(phase_decorate, decorated - found);
+    if (times) times->decorated = decorated;
+    xcb.disconnect(connection);
+    _exit(0);
+  }
+  if (pid > 0) metrics_count(metric_decorators);
+  if (times && pid > 0) {
+    std::lock_guard<std::mutex> lock(decorator_mutex);
+    decorator_traces[pid] = times;
+  } else if (times) {
+    munmap(times, sizeof(decorator_times));
+  }
+  return pid;
+}
+
+// reads until end of file
+string descriptor_read(int fd) {
+  string result;
+  char buffer[4096];
+  ssize_t count;
+  while ((count = read(fd, buffer, sizeof(buffer))) > 0 || (count == -1 && errno == EINTR))
+    if (count > 0) result.append(buffer, count);
+  return result;
+}
+
+// sends as much of pending as the socket takes; without block a full socket
+// just leaves the rest in pending for later
+bool socket_send(int fd, string &pending, bool block) {
+  while (!pending.empty()) {
+    ssize_t sent = send(fd, pending.data(), pending.length(), (block ? 0 : MSG_DONTWAIT) | MSG_NOSIGNAL);
+    if (sent > 0) { pending.erase(0, sent); continue; }
+    if (sent == -1 && errno == EINTR) continue;
+    return (!block && sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+  }
+  return true;
+}
+
+// runs command through /bin/sh with its stdin and stdout moved onto the
+// given descriptors (-1 keeps ours) and returns the shell's pid; own_group
+// puts the shell in a process group of its own so it can be killed whole
+process_t process_spawn(const string &command, int child_stdin, int child_stdout, bool own_group) {
+  trace_scope scope(phase_spawn);
+  process_t child = fork();
+  if (child == 0) {
+    if (own_group) setpgid(0, 0);
+    if (child_stdin != -1) dup2(child_stdin, STDIN_FILENO);
+    if (child_stdout != -1) dup2(child_stdout, STDOUT_FILENO);
+    execl("/bin/sh", "sh", "-c", command.c_str(), (char *)nullptr);
+    _exit(127);
+  }
+  if (child > 0) metrics_count(metric_spawns);
+  DLGMOD_PROBE2(engine__spawn, (int)child, command.c_str());
+  return child;
+}
+
+// like popen(), but hands back the shell's pid so the decorator can tell our
+// dialog apart from ones other threads have open at the same time
+FILE *process_open(const string &command, process_t *pid) {
+  int fd[2];
+  if (pipe2(fd, O_CLOEXEC) == -1) return nullptr;
+  process_t child = process_spawn(command, -1, fd[1], false);
+  close(fd[1]);
+  if (child == -1) {
+    close(fd[0]);
+    return nullptr;
+  }
+  *pid = child;
+  return fdopen(fd[0], "r");
+}
+
+// stops the window decorator started by modify_dialog()
+void modify_dialog_reap(process_t pid) {
+  if (pid <= 0) return;
+  trace_scope scope(phase_reap_decorator);
+  int status;
+  // the decorator has usually finished by the time the dialog closes
+  bool died = (waitpid(pid, &status, WNOHANG) == pid);
+  if (!died) kill(pid, SIGTERM);
+  for (unsigned i = 0; !died && i < 100; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (waitpid(pid, &status, WNOHANG) == pid) died = true;
+  }
+  if (!died) {
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+  }
+  DLGMOD_PROBE2(child__reaped, (int)pid, status);
+  decorator_times_record(pid);
+}
+
+string shellscript_run(const string &command, const dialog_context &ctx) {
+  char *buffer = nullptr;
+  size_t buffer_size = 0;
+  string str_buffer;
+  process_t ppid = 0;
+  FILE *file = process_open(command, &ppid);
+  if (!file) return "";
+  process_t pid = modify_dialog(ppid, ctx);
+  trace_wait(fileno(file));
+  {
+    trace_scope scope(phase_drain);
+    while (getline(&buffer, &buffer_size, file) != -1)
+      str_buffer += buffer;
+    free(buffer);
+    fclose(file);
+    metrics_count(metric_pipe_bytes, str_buffer.length());
+  }
+  {
+    trace_scope scope(phase_reap);
+    int status;
+    waitpid(ppid, &status, 0);
+    DLGMOD_PROBE2(child__reaped, (int)ppid, status);
+  }
+  modify_dialog_reap(pid);
+  if (!str_buffer.empty() && str_buffer.back() == '\n')
+    str_buffer.pop_back();
+  return str_buffer;
+}
+
+// the "Mock" system's script: answers are handed out in order, each after
+// its delay, and once they run out the last one keeps being repeated. an
+// answer is what the zenity command would have printed, or for the text
+// dialog its exit status
+struct mock_answer {
+  string text;
+  double delay = 0;
+};
+
+std::mutex mock_mutex;
+std::deque<mock_answer> mock_queue;
+mock_answer mock_last;
+
+string mock_evaluate() {
+  mock_answer answer;
+  {
+    std::lock_guard<std::mutex> lock(mock_mutex);
+    if (!mock_queue.empty()) {
+      mock_last = mock_queue.front();
+      mock_queue.pop_front();
+    }
+    answer = mock_last;
+  }
+  if (answer.delay > 0)
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(answer.delay));
+  return answer.text;
+}
+
+string shellscript_evaluate(const string &command, const dialog_context &ctx) {
+  DLGMOD_PROBE1(dialog__start, command.c_str());
+  string result;
+  if (ctx.mock) {
+    result = mock_evaluate();
+  } else {
+    trace_scope scope(phase_dialog);
+    result = shellscript_run(command, ctx);
+  }
+  DLGMOD_PROBE1(dialog__end, result.c_str());
+  return result;
+}
+
+string add_escaping(const string &str, bool is_caption, const string &new_caption) {
+  counter_scope scope(counter_add_escaping);
+  const string &source = (is_caption && str == "") ? new_caption : str;
+  bool invalid = false;
+  bool repair = utf8_repair.load(std::memory_order_relaxed);
+  string result(text_escape(nullptr, source.data(), source.length(), true, true, repair, invalid), '\0');
+  if (invalid) metrics_count(metric_invalid_utf8);
+  text_escape(&result[0], source.data(), source.length(), true, true, repair, invalid);
+  return result;
+}
+
+// commands are put together as a list of pieces pointing at the caller's
+// strings; finish() adds up the final length, escapes included, then
+// writes every piece into a buffer the thread keeps from one dialog to the
+// next. once that buffer and the list have grown to fit, escaping and
+// writing out allocate nothing; the strings the pieces point at, such as
+// the captured context, are still the callers' own
+struct command_piece {
+  // paths are escaped like text, but are bytes the file system gave us and
+  // have to stay exactly that
+  enum kind_t { text, escaped, path, number } kind;
+  const char *data;
+  size_t length;
+};
+
+struct command_builder {
+  vector<command_piece> pieces;
+  string buffer;
+
+  command_builder &piece(command_piece::kind_t kind, const char *data, size_t length) {
+    pieces.push_back({ kind, data, length });
+    return *this;
+  }
+  command_builder &text(const char *str) { return piece(command_piece::text, str, str ? strlen(str) : 0); }
+  command_builder &text(const string &str) { return piece(command_piece::text, str.data(), str.length()); }
+  command_builder &escaped(const char *str) { return piece(command_piece::escaped, str, str ? strlen(str) : 0); }
+  command_builder &escaped(const string &str) { return piece(command_piece::escaped, str.data(), str.length()); }
+  command_builder &path(const char *str) { return piece(command_piece::path, str, str ? strlen(str) : 0); }
+  command_builder &path(const string &str) { return piece(command_piece::path, str.data(), str.length()); }
+  command_builder &number(size_t value) { return piece(command_piece::number, nullptr, value); }
+
+  // the engine's window icon flag, if the icon is there to be shown
+  command_builder &icon(const dialog_context &ctx) {
+    if (!file_exists(ctx.icon)) return *this;
+    return text((ctx.engine == dm_zenity) ? " --window-icon=\"" : " --icon \"").path(ctx.icon).text("\"");
+  }
+
+  const string &finish() {
+    counter_scope scope(counter_command_build);
+    char digits[24];
+    size_t length = 0;
+    bool repair = utf8_repair.load(std::memory_order_relaxed), unchecked = false;
+    for (const command_piece &next : pieces) {
+      bool invalid = false;
+      if (next.kind == command_piece::escaped) length += text_escape(nullptr, next.data, next.length, true, true, repair, invalid);
+      else if (next.kind == command_piece::path) length += text_escape(nullptr, next.data, next.length, true, false, false, unchecked);
+      else if (next.kind == command_piece::number) length += snprintf(digits, sizeof(digits), "%zu", next.length);
+      else length += next.length;
+      if (invalid) metrics_count(metric_invalid_utf8);
+    }
+    buffer.resize(length);
+    char *out = &buffer[0];
+    for (const command_piece &next : pieces) {
+      if (next.kind == command_piece::escaped || next.kind == command_piece::path) {
+        bool text = next.kind == command_piece::escaped;
+        out += text_escape(out, next.data, next.length, true, text, text && repair, unchecked);
+      } else if (next.kind == command_piece::number) {
+        int count = snprintf(digits, sizeof(digits), "%zu", next.length);
+        memcpy(out, digits, count);
+        out += count;
+      } else {
+        memcpy(out, next.data, next.length);
+        out += next.length;
+      }
+    }
+    pieces.clear();
+    return buffer;
+  }
+};
+
+// one builder per thread, so what finish() returns stays good only until
+// the same thread starts on its next command
+command_builder &command_begin() {
+  thread_local command_builder builder;
+  builder.pieces.clear();
+  return builder;
+}
+
+string remove_trailing_zeros(double numb) {
+  string strnumb = std::to_string(numb);
+
+  while (!strnumb.empty() && strnumb.find('.') != string::npos && (strnumb.back() == '.' || strnumb.back() == '0'))
+    strnumb.pop_back();
+
+  return strnumb;
+}
+
+string zenity_filter(string input) {
+  counter_scope scope(counter_zenity_filter);
+  input = string_replace_all(input, "\r", "");
+  input = string_replace_all(input, "\n", "");
+  std::vector<string> stringVec = string_split(input, '|');
+  string string_output = "";
+
+  unsigned index = 0;
+  for (string str : stringVec) {
+    if (index % 2 == 0)
+      string_output += string(" --file-filter=\"") + 
+        add_escaping(string_replace_all(str, "*.*", "*"), false, "") + string("|");
+    else {
+      std::replace(str.begin(), str.end(), ';', ' ');
+      string_output += add_escaping(string_replace_all(str, "*.*", "*"), false, "") + string("\"");
+    }
+
+    index += 1;
+  }
+
+  return string_output;
+}
+
+string kdialog_filter(string input) {
+  counter_scope scope(counter_kdialog_filter);
+  input = string_replace_all(input, "\r", "");
+  input = string_replace_all(input, "\n", "");
+  std::vector<string> stringVec = string_split(input, '|');
+  string string_output = " \"";
+
+  unsigned index = 0;
+  for (string str : stringVec) {
+    if (index % 2 == 0) {
+      if (index != 0)
+        string_output += "\n";
+      size_t first = str.find('(');
+      if (first != string::npos) {
+        size_t last = str.find(')', first);
+        if (last != string::npos)
+          str.erase(first, last - first + 1);
+      }
+      string_output += add_escaping(str, false, "") + string(" (");
+    } else {
+      std::replace(str.begin(), str.end(), ';', ' ');
+      string_output += add_escaping(string_replace_all(str, "*.*", "*"), false, "") + string(")");
+    }
+
+    index += 1;
+  }
+
+  string_output += "\"";
+  return string_output;
+}
+
+int color_get_red(int col) { return ((col & 0x000000FF)); }
+int color_get_green(int col) { return ((col & 0x0000FF00) >> 8); }
+int color_get_blue(int col) { return ((col & 0x00FF0000) >> 16); }
+
+int make_color_rgb(unsigned char r, unsigned char g, unsigned char b) {
+  return r | (g << 8) | (b << 16);
+}
+
+// zenity answers rgb(r,g,b) or rgba(r,g,b,a); missing channels keep defcol's
+int zenity_color(string str_result, int defcol) {
+  int red = color_get_red(defcol);
+  int green = color_get_green(defcol);
+  int blue = color_get_blue(defcol);
+  str_result = string_replace_all(str_result, "rgba(", "");
+  str_result = string_replace_all(str_result, "rgb(", "");
+  str_result = string_replace_all(str_result, ")", "");
+  std::vector<string> stringVec = string_split(str_result, ',');
+
+  unsigned int index = 0;
+  for (const string &str : stringVec) {
+    if (index == 0) red = strtod(str.c_str(), nullptr);
+    if (index == 1) green = strtod(str.c_str(), nullptr);
+    if (index == 2) blue = strtod(str.c_str(), nullptr);
+    index += 1;
+  }
+
+  return (int)make_color_rgb(red, green, blue);
+}
+
+// kdialog answers #RRGGBB
+int kdialog_color(string str_result) {
+  str_result = str_result.substr(1, str_result.length() - 1);
+
+  unsigned int color = 0;
+  std::stringstream ss2;
+  ss2 << std::hex << str_result;
+  ss2 >> color;
+
+  return (int)make_color_rgb(color_get_blue(color), color_get_green(color), color_get_red(color));
+}
+
+bool is_file_dialog(int type) {
+  return (type == DIALOG_OPEN_FILENAME || type == DIALOG_OPEN_FILENAMES ||
+    type == DIALOG_SAVE_FILENAME || type == DIALOG_DIRECTORY);
+}
+
+const char *default_caption(int type) {
+  switch (type) {
+    case DIALOG_MESSAGE:              return "Information";
+    case DIALOG_MESSAGE_CANCELABLE:   return "Question";
+    case DIALOG_QUESTION:             return "Question";
+    case DIALOG_QUESTION_CANCELABLE:  return "Question";
+    case DIALOG_ATTEMPT:              return "Error";
+    case DIALOG_ERROR:                return "Error";
+    case DIALOG_ERROR_ABORT:          return "Error";
+    case DIALOG_GET_STRING:           return "Input Query";
+    case DIALOG_GET_PASSWORD:         return "Input Query";
+    case DIALOG_OPEN_FILENAME:        return "Open";
+    case DIALOG_OPEN_FILENAMES:       return "Open";
+    case DIALOG_SAVE_FILENAME:        return "Save As";
+    case DIALOG_DIRECTORY:            return "Select Directory";
+  }
+  return "";
+}
+
+// the parts of a dialog's command that do not depend on the text it shows
+struct dialog_template {
+  int type;
+  dialog_context ctx;
+  string str_filter;
+  // as given, for the GTK engine
+  string filter;
+  // message and input dialogs: the whole command, split where the text goes
+  string prefix;
+  string suffix;
+};
+
+// title == nullptr takes the caption set with widget_set_caption()
+dialog_template make_template(int type, const char *title, const char *filter) {
+  dialog_template tpl;
+  tpl.type = type;
+  tpl.ctx = capture_context(title, default_caption(type));
+  if (filter && type != DIALOG_DIRECTORY)
+    tpl.filter = filter;
+  if (filter && type != DIALOG_DIRECTORY)
+    tpl.str_filter = (tpl.ctx.engine == dm_zenity) ? zenity_filter(filter) : kdialog_filter(filter);
+  return tpl;
+}
+
+void gtk_decorate(void *window, const dialog_context &ctx) {
+  gtk.window_set_title(window, ctx.caption.c_str());
+  if (file_exists(ctx.icon)) gtk.window_set_icon_from_file(window, ctx.icon.c_str(), nullptr);
+  gtk.window_set_keep_above(window, true);
+}
+
+// answers the same way the shell commands built by message_command() print
+// theirs, so message_result() and the callers stay the same for every engine
+string gtk_message(const dialog_context &ctx, int type, const string &str_text, const string &str_def) {
+  string result;
+  gtk_invoke([&]() {
+    // message types: info, warning, question, error
+    int icon = 0;
+    int closed = 1;
+    vector<std::pair<string, int>> buttons;
+    switch (type) {
+      case DIALOG_MESSAGE:
+        buttons = { { ctx.btn_array[BUTTON_OK], 1 } };
+        break;
+      case DIALOG_MESSAGE_CANCELABLE:
+        icon = 2; closed = -1;
+        buttons = { { ctx.btn_array[BUTTON_CANCEL], -1 }, { ctx.btn_array[BUTTON_OK], 1 } };
+        break;
+      case DIALOG_QUESTION:
+        icon = 2; closed = 0;
+        buttons = { { ctx.btn_array[BUTTON_NO], 0 }, { ctx.btn_array[BUTTON_YES], 1 } };
+        break;
+      case DIALOG_QUESTION_CANCELABLE:
+        icon = 2; closed = -1;
+        buttons = { { ctx.btn_array[BUTTON_CANCEL], -1 }, { ctx.btn_array[BUTTON_NO], 0 }, { ctx.btn_array[BUTTON_YES], 1 } };
+        break;
+      case DIALOG_ATTEMPT:
+        icon = 3; closed = -1;
+        buttons = { { ctx.btn_array[BUTTON_CANCEL], -1 }, { ctx.btn_array[BUTTON_RETRY], 0 } };
+        break;
+      case DIALOG_ERROR:
+        icon = 3; closed = -1;
+        buttons = { { ctx.btn_array[BUTTON_IGNORE], -1 }, { ctx.btn_array[BUTTON_ABORT], 1 } };
+        break;
+      case DIALOG_ERROR_ABORT:
+        icon = 3;
+        buttons = { { ctx.btn_array[BUTTON_ABORT], 1 } };
+        break;
+      case DIALOG_GET_STRING:
+      case DIALOG_GET_PASSWORD:
+        icon = 2;
+        buttons = { { ctx.btn_array[BUTTON_CANCEL], gtk_response_cancel }, { ctx.btn_array[BUTTON_OK], gtk_response_ok } };
+        break;
+    }
+    // buttons answer with their result offset by 2, so none of them is negative
+    void *dialog = gtk.message_dialog_new(nullptr, 1, icon, 0, "%s", str_text.c_str());
+    gtk_decorate(dialog, ctx);
+    bool input = (type == DIALOG_GET_STRING || type == DIALOG_GET_PASSWORD);
+    for (const std::pair<string, int> &button : buttons)
+      gtk.dialog_add_button(dialog, button.first.c_str(), input ? button.second : button.second + 2);
+    void *entry = nullptr;
+    if (input) {
+      entry = gtk.entry_new();
+      gtk.entry_set_text(entry, str_def.c_str());
+      gtk.entry_set_visibility(entry, type != DIALOG_GET_PASSWORD);
+      gtk.entry_set_activates_default(entry, true);
+      gtk.container_add(gtk.message_dialog_get_message_area(dialog), entry);
+      gtk.widget_show(entry);
+      gtk.dialog_set_default_response(dialog, gtk_response_ok);
+    }
+    int response = gtk.dialog_run(dialog);
+    if (input) result = (response == gtk_response_ok) ? gtk.entry_get_text(entry) : "";
+    else result = to_string((response >= 0) ? response - 2 : closed);
+    gtk.widget_destroy(dialog);
+  });
+  return result;
+}
+
+// "Name|*.a;*.b|Name|*.*" as name and pattern pairs, *.* meaning everything
+filter_list filter_pairs(string input) {
+  input = string_replace_all(input, "\r", "");
+  input = string_replace_all(input, "\n", "");
+  std::vector<string> stringVec = string_split(input, '|');
+  filter_list filters;
+  for (size_t i = 0; i + 1 < stringVec.size(); i += 2) {
+    vector<string> patterns;
+    for (const string &pattern : string_split(stringVec[i + 1], ';'))
+      patterns.push_back(string_replace_all(pattern, "*.*", "*"));
+    filters.push_back(std::make_pair(stringVec[i], patterns));
+  }
+  return filters;
+}
+
+void gtk_add_filters(void *chooser, const string &input) {
+  for (const std::pair<string, vector<string>> &item : filter_pairs(input)) {
+    void *filter = gtk.file_filter_new();
+    gtk.file_filter_set_name(filter, item.first.c_str());
+    for (const string &pattern : item.second)
+      gtk.file_filter_add_pattern(filter, pattern.c_str());
+    gtk.file_chooser_add_filter(chooser, filter);
+  }
+}
+
+// where an in-process chooser starts; the path may be a directory or a file
+// that does not exist yet, which filename_absolute() would both turn into ""
+string chooser_path(const dialog_template &tpl, char *fname, char *dir) {
+  string str_path = fname;
+  string str_dir = dir ? dir : "";
+  if (tpl.type != DIALOG_DIRECTORY && str_dir != "" && str_path[0] != '/')
+    str_path = str_dir + string("/") + str_path;
+  if (str_path != "" && str_path[0] != '/') {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, PATH_MAX)) str_path = cwd + string("/") + str_path;
+  }
+  return str_path;
+}
+
+bool directory_exists(const string &dname) {
+  struct stat sb;
+  return (stat(dname.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode));
+}
+
+string parent_directory(const string &fname) {
+  char *str_copy = strdup(fname.c_str());
+  string result = dirname(str_copy);
+  free(str_copy);
+  return result;
+}
+
+// same answers as the zenity commands from file_command()
+string gtk_file(const dialog_template &tpl, char *fname, char *dir) {
+  string str_path = chooser_path(tpl, fname, dir);
+  string result;
+  gtk_invoke([&]() {
+    // actions: open, save, select folder
+    int action = (tpl.type == DIALOG_SAVE_FILENAME) ? 1 : ((tpl.type == DIALOG_DIRECTORY) ? 2 : 0);
+    void *chooser = gtk.file_chooser_native_new(tpl.ctx.caption.c_str(), nullptr, action, nullptr, nullptr);
+    gtk.file_chooser_set_select_multiple(chooser, tpl.type == DIALOG_OPEN_FILENAMES);
+    gtk.file_chooser_set_do_overwrite_confirmation(chooser, tpl.type == DIALOG_SAVE_FILENAME);
+    gtk_add_filters(chooser, tpl.filter);
+    if (str_path != "") {
+      if (directory_exists(str_path))
+        gtk.file_chooser_set_current_folder(chooser, str_path.c_str());
+      else {
+        gtk.file_chooser_set_current_folder(chooser, parent_directory(str_path).c_str());
+        if (tpl.type == DIALOG_SAVE_FILENAME)
+          gtk.file_chooser_set_current_name(chooser, filename_name(str_path).c_str());
+        else if (file_exists(str_path))
+          gtk.file_chooser_set_filename(chooser, str_path.c_str());
+      }
+    }
+    if (gtk.native_dialog_run(chooser) == gtk_response_accept) {
+      if (tpl.type == DIALOG_OPEN_FILENAMES) {
+        gtk_slist *list = gtk.file_chooser_get_filenames(chooser);
+        for (gtk_slist *item = list; item; item = item->next) {
+          result += (result.empty() ? "" : "\n") + string((char *)item->data);
+          gtk.free(item->data);
+        }
+        gtk.slist_free(list);
+      } else if (char *filename = gtk.file_chooser_get_filename(chooser)) {
+        result = filename;
+        gtk.free(filename);
+        if (tpl.type == DIALOG_DIRECTORY && result != "/") result += "/";
+      }
+    }
+    gtk.object_unref(chooser);
+  });
+  return result;
+}
+
+// file:// URIs the portal answers with, back to plain paths
+string portal_uri_path(const string &uri) {
+  if (uri.compare(0, 7, "file://") != 0) return "";
+  size_t start = uri.find('/', 7);
+  if (start == string::npos) return "";
+  string result;
+  for (size_t i = start; i < uri.length(); i++) {
+    if (uri[i] == '%' && i + 2 < uri.length()) {
+      result += (char)strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16);
+      i += 2;
+    } else result += uri[i];
+  }
+  return result;
+}
+
+// same answers as gtk_file(); false when the portal could not be asked at
+// all, so the caller can run the shell command instead
+bool portal_file(const dialog_template &tpl, char *fname, char *dir, string &result) {
+  portal_request request;
+  request.method = (tpl.type == DIALOG_SAVE_FILENAME) ? "SaveFile" : "OpenFile";
+  if (tpl.ctx.owner) {
+    char parent[32];
+    snprintf(parent, sizeof(parent), "x11:%lx", (unsigned long)tpl.ctx.owner);
+    request.parent = parent;
+  }
+  request.title = tpl.ctx.caption;
+  request.multiple = (tpl.type == DIALOG_OPEN_FILENAMES);
+  request.directory = (tpl.type == DIALOG_DIRECTORY);
+  request.filters = filter_pairs(tpl.filter);
+  string str_path = chooser_path(tpl, fname, dir);
+  if (str_path != "") {
+    if (directory_exists(str_path))
+      request.current_folder = str_path;
+    else {
+      request.current_folder = parent_directory(str_path);
+      if (tpl.type == DIALOG_SAVE_FILENAME) {
+        request.current_name = filename_name(str_path);
+        if (file_exists(str_path)) request.current_file = str_path;
+      }
+    }
+  }
+  {
+    std::unique_lock<std::mutex> lock(portal_mutex);
+    if (!portal.connection) return false;
+    portal.queued.push_back(&request);
+    char wake = 0;
+    if (write(portal.wake[1], &wake, 1) == -1 && errno != EAGAIN) {
+      portal.queued.pop_back();
+      return false;
+    }
+    portal_changed.wait(lock, [&request]() {
+      return (request.state == PORTAL_DONE || request.state == PORTAL_FAILED);
+    });
+  }
+  if (request.state == PORTAL_FAILED) return false;
+  result = "";
+  if (request.response == 0) {
+    for (const string &uri : request.uris) {
+      string str_file = portal_uri_path(uri);
+      if (str_file == "") continue;
+      if (tpl.type == DIALOG_DIRECTORY && str_file != "/") str_file += "/";
+      result += (result.empty() ? "" : "\n") + str_file;
+    }
+  }
+  return true;
+}
+
+// the resident daemon: one process per user and display that keeps GTK
+// loaded and shows message, input and file dialogs for every client, so they
+// come up without a zenity or kdialog having to start first. it is the
+// dlgmodd helper next to this library, started with exec() so it owns
+// nothing of the client's memory or threads. it only lives in the per-user
+// XDG_RUNTIME_DIR, so without one there is no daemon, and when it can not
+// load GTK, or already has a dialog up, the client shows its own.
+// requests and replies are a fixed header followed by length-prefixed fields
+std::atomic<bool> daemon_enabled(false);
+// set once a daemon could not be started, so nobody waits on one again
+std::atomic<bool> daemon_failed(false);
+std::chrono::minutes const daemon_idle(10);
+uint32_t const daemon_magic = 0x4d474c44; // "DLGM"
+uint32_t const daemon_version = 2;
+
+enum DAEMON_REQUESTS {
+  DAEMON_MESSAGE,
+  DAEMON_FILE
+};
+
+struct daemon_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t length;
+};
+
+string daemon_path() {
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  if (!runtime || !*runtime) return "";
+  string display = getenv("DISPLAY") ? getenv("DISPLAY") : "";
+  std::replace(display.begin(), display.end(), '/', '_');
+  return string(runtime) + string("/dlgmod-") + display + string(".sock");
+}
+
+bool daemon_address(sockaddr_un *addr) {
+  string path = daemon_path();
+  if (path.empty() || path.length() >= sizeof(addr->sun_path)) return false;
+  memset(addr, 0, sizeof(sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path.c_str());
+  return true;
+}
+
+void daemon_put(string &message, uint64_t value) {
+  message.append((const char *)&value, sizeof(value));
+}
+
+void daemon_put(string &message, const string &str) {
+  daemon_put(message, (uint64_t)str.length());
+  message += str;
+}
+
+bool daemon_get(const string &message, size_t &pos, uint64_t &value) {
+  if (message.length() - pos < sizeof(value)) return false;
+  memcpy(&value, message.data() + pos, sizeof(value));
+  pos += sizeof(value);
+  return true;
+}
+
+bool daemon_get(const string &message, size_t &pos, string &str) {
+  uint64_t length;
+  if (!daemon_get(message, pos, length) || message.length() - pos < length) return false;
+  str = message.substr(pos, length);
+  pos += length;
+  return true;
+}
+
+bool daemon_write(int fd, const string &body) {
+  daemon_header header = { daemon_magic, daemon_version, (uint32_t)body.length() };
+  string pending((const char *)&header, sizeof(header));
+  pending += body;
+  return socket_send(fd, pending, true);
+}
+
+bool daemon_read_exact(int fd, char *buffer, size_t length) {
+  while (length) {
+    ssize_t count = read(fd, buffer, length);
+    if (count == -1 && errno == EINTR) continue;
+    if (count <= 0) return false;
+    buffer += count;
+    length -= count;
+  }
+  return true;
+}
+
+bool daemon_read(int fd, string &body) {
+  daemon_header header;
+  if (!daemon_read_exact(fd, (char *)&header, sizeof(header))) return false;
+  if (header.magic != daemon_magic || header.version != daemon_version) return false;
+  body.resize(header.length);
+  return daemon_read_exact(fd, &body[0], header.length);
+}
+
+// a socket left behind by someone else is never trusted
+bool daemon_peer_is_us(int fd) {
+  #if defined(__linux__)
+  ucred cred;
+  socklen_t length = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == -1) return false;
+  return cred.uid == getuid();
+  #else
+  uid_t uid; gid_t gid;
+  if (getpeereid(fd, &uid, &gid) == -1) return false;
+  return uid == getuid();
+  #endif
+}
+
+// shows one dialog on behalf of a client; only one at a time, as GTK runs
+// them on its one thread, so a client that finds one up is told to show its own
+std::atomic<bool> daemon_busy(false);
+
+void daemon_session(int fd) {
+  string request, caption, icon, first, second;
+  uint64_t kind, type;
+  dialog_template tpl;
+  size_t pos = 0;
+  bool valid = daemon_read(fd, request) && daemon_get(request, pos, kind) && daemon_get(request, pos, type) &&
+    daemon_get(request, pos, caption) && daemon_get(request, pos, icon);
+  for (int i = 0; valid && i < btn_array_len; i++)
+    valid = daemon_get(request, pos, tpl.ctx.btn_array[i]);
+  valid = valid && daemon_get(request, pos, first) && daemon_get(request, pos, second) &&
+    (int)type >= DIALOG_MESSAGE && (int)type <= DIALOG_DIRECTORY && is_file_dialog((int)type) == (kind == DAEMON_FILE);
+  if (valid) {
+    string reply;
+    bool expected = false;
+    if (daemon_busy.compare_exchange_strong(expected, true)) {
+      tpl.type = (int)type;
+      tpl.ctx.engine = dm_gtk;
+      tpl.ctx.gtk = true;
+      tpl.ctx.caption = caption;
+      tpl.ctx.icon = icon;
+      string result;
+      // the text and its default, or the filter and the absolute path to start from
+      if (kind == DAEMON_MESSAGE) {
+        result = gtk_message(tpl.ctx, tpl.type, first, second);
+      } else {
+        tpl.filter = first;
+        result = gtk_file(tpl, (char *)second.c_str(), (char *)"");
+      }
+      daemon_busy.store(false);
+      daemon_put(reply, (uint64_t)1);
+      daemon_put(reply, result);
+    } else {
+      daemon_put(reply, (uint64_t)0);
+    }
+    daemon_write(fd, reply);
+  }
+  close(fd);
+}
+
+// the helper runs this; it holds a lock for as long as it serves, so two
+// clients racing to start one get one. the lock file must be a plain file
+// of our own, so nobody else can hold it or point it somewhere else
+void daemon_serve() {
+  descriptors_close_from(STDERR_FILENO + 1);
+  int fd_null = open("/dev/null", O_RDWR);
+  if (fd_null != -1) {
+    dup2(fd_null, STDIN_FILENO);
+    dup2(fd_null, STDOUT_FILENO);
+    dup2(fd_null, STDERR_FILENO);
+    if (fd_null > STDERR_FILENO) close(fd_null);
+  }
+  sockaddr_un addr;
+  if (!daemon_address(&addr)) return;
+  string lock_path = string(addr.sun_path) + string(".lock");
+  int fd_lock = open(lock_path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC | O_NOFOLLOW, 0600);
+  if (fd_lock == -1) return;
+  struct stat lock_stat;
+  if (fstat(fd_lock, &lock_stat) == -1 || !S_ISREG(lock_stat.st_mode) || lock_stat.st_uid != getuid()) return;
+  if (flock(fd_lock, LOCK_EX | LOCK_NB) == -1) return;
+  // GTK is what it is kept for; without it, clients are better off on their own
+  if (!gtk_load()) return;
+  unlink(addr.sun_path);
+  int fd_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  mode_t mask = umask(0077);
+  bool bound = (fd_listen != -1 && bind(fd_listen, (sockaddr *)&addr, sizeof(addr)) == 0);
+  umask(mask);
+  if (!bound || listen(fd_listen, 64) == -1) return;
+  std::atomic<unsigned> sessions(0);
+  for (;;) {
+    pollfd pfd = { fd_listen, POLLIN, 0 };
+    int ready = poll(&pfd, 1, std::chrono::milliseconds(daemon_idle).count());
+    if (ready == -1 && errno == EINTR) continue;
+    if (ready == 0 && sessions.load() == 0) break;
+    if (ready <= 0) continue;
+    int fd = accept4(fd_listen, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1) continue;
+    if (!daemon_peer_is_us(fd)) { close(fd); continue; }
+    sessions++;
+    std::thread([fd, &sessions] { daemon_session(fd); sessions--; }).detach();
+  }
+  unlink(addr.sun_path);
+}
+
+string daemon_helper() {
+  Dl_info info;
+  if (!dladdr((void *)&daemon_helper, &info) || !info.dli_fname) return "";
+  string library = info.dli_fname;
+  size_t slash = library.rfind('/');
+  return ((slash == string::npos) ? string(".") : library.substr(0, slash)) + string("/dlgmodd");
+}
+
+// the helper is double-forked so it is nobody's child; the path is worked
+// out first, since between fork() and exec() only async-signal-safe calls
+// are allowed
+void daemon_launch() {
+  string helper = daemon_helper();
+  if (helper.empty() || access(helper.c_str(), X_OK) == -1) return;
+  char *argv[] = { (char *)helper.c_str(), nullptr };
+  process_t pid = fork();
+  if (pid == 0) {
+    setsid();
+    if (fork() == 0) {
+      execv(argv[0], argv);
+      _exit(127);
+    }
+    _exit(0);
+  }
+  int status;
+  if (pid > 0) waitpid(pid, &status, 0);
+}
+
+int daemon_connect() {
+  sockaddr_un addr;
+  if (!daemon_address(&addr)) return -1;
+  for (unsigned attempt = 0; attempt < 50; attempt++) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0) {
+      if (daemon_peer_is_us(fd)) return fd;
+      close(fd);
+      return -1;
+    }
+    close(fd);
+    if (attempt == 0) daemon_launch();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  return -1;
+}
+
+// false when there is no daemon to show the dialog, so the caller shows it
+// with its own engine; the text is checked as it would be for GTK here
+bool daemon_request(int kind, int type, const dialog_context &ctx, const string &first, const string &second, string &result) {
+  if (!daemon_enabled.load(std::memory_order_relaxed) || daemon_failed.load(std::memory_order_relaxed) || ctx.mock) return false;
+  trace_scope scope(phase_daemon);
+  int fd = daemon_connect();
+  if (fd == -1) {
+    daemon_failed.store(true);
+    return false;
+  }
+  string request, reply;
+  daemon_put(request, (uint64_t)kind);
+  daemon_put(request, (uint64_t)type);
+  daemon_put(request, utf8_text(ctx.caption));
+  daemon_put(request, ctx.icon);
+  for (int i = 0; i < btn_array_len; i++)
+    daemon_put(request, utf8_text(ctx.btn_array[i]));
+  daemon_put(request, first);
+  daemon_put(request, second);
+  uint64_t shown = 0;
+  size_t pos = 0;
+  bool answered = daemon_write(fd, request) && daemon_read(fd, reply) &&
+    daemon_get(reply, pos, shown) && shown && daemon_get(reply, pos, result);
+  close(fd);
+  if (answered) metrics_count(metric_pipe_bytes, result.length());
+  return answered;
+}
+
+bool daemon_message(const dialog_context &ctx, int type, const char *str_text, const char *str_def, string &result) {
+  return daemon_request(DAEMON_MESSAGE, type, ctx, utf8_text(str_text ? str_text : ""), utf8_text(str_def ? str_def : ""), result);
+}
+
+bool daemon_file(const dialog_template &tpl, char *fname, char *dir, string &result) {
+  return daemon_request(DAEMON_FILE, tpl.type, tpl.ctx, tpl.filter, chooser_path(tpl, fname, dir), result);
+}
+
+// str_text and str_def are the caller's raw text; the builder escapes them
+const string &message_command(const dialog_template &tpl, const char *str_text, const char *str_def) {
+  trace_scope scope(phase_build);
+  const dialog_context &ctx = tpl.ctx;
+  command_builder &command = command_begin();
+
+  if (tpl.type == DIALOG_MESSAGE || tpl.type == DIALOG_MESSAGE_CANCELABLE) {
+    bool message_cancel = (tpl.type == DIALOG_MESSAGE_CANCELABLE);
+    const char *str_echo = "echo 1";
+
+    if (message_cancel)
+      str_echo = "if [ $? = 0 ] ;then echo 1;else echo -1;fi";
+
+    if (ctx.engine == dm_zenity) {
+      command.text("ans=$(zenity ");
+
+      if (message_cancel)
+        command.text("--question --ok-label=\"").escaped(ctx.btn_array[BUTTON_OK]).text("\" --cancel-label=\"").escaped(ctx.btn_array[BUTTON_CANCEL]).text("\" ");
+      else
+        command.text("--info --ok-label=\"").escaped(ctx.btn_array[BUTTON_OK]).text("\" ");
+
+      command.text("--title=\"").escaped(ctx.caption).text("\" --no-wrap --text=\"").escaped(str_text).
+      text(message_cancel ? "\" --icon-name=dialog-question" : "\" --icon-name=dialog-information").icon(ctx).text(");").text(str_echo);
+    }
+    else if (ctx.engine == dm_kdialog) {
+      command.text("kdialog ");
+
+      if (message_cancel)
+        command.text("--yesno \"").escaped(str_text).text("\" --yes-label \"").escaped(ctx.btn_array[BUTTON_OK]).text("\" --no-label \"").escaped(ctx.btn_array[BUTTON_CANCEL]).text("\"").icon(ctx).text(" ");
+      else
+        command.text("--msgbox \"").escaped(str_text).text("\" --ok-label \"").escaped(ctx.btn_array[BUTTON_OK]).text("\"").icon(ctx).text(" ");
+
+      command.text("--title \"").escaped(ctx.caption).text("\";").text(str_echo);
+    }
+  }
+  else if (tpl.type == DIALOG_QUESTION || tpl.type == DIALOG_QUESTION_CANCELABLE) {
+    bool question_cancel = (tpl.type == DIALOG_QUESTION_CANCELABLE);
+
+    if (ctx.engine == dm_zenity) {
+      command.text("ans=$(zenity ").
+      text("--question --ok-label=\"").escaped(ctx.btn_array[BUTTON_YES]).text("\" --cancel-label=\"").escaped(ctx.btn_array[BUTTON_NO]).text("\" ");
+
+      if (question_cancel)
+        command.text("--extra-button=\"").escaped(ctx.btn_array[BUTTON_CANCEL]).text("\" ");
+
+      command.text("--title=\"").
+      escaped(ctx.caption).text("\" --no-wrap --text=\"").escaped(str_text).
+      text("\" --icon-name=dialog-question").icon(ctx).text(");if [ $? = 0 ] ;then echo 1;elif [ $ans = \"").text(ctx.btn_array[BUTTON_CANCEL]).text("\" ] ;then echo -1;else echo 0;fi");
+    }
+    else if (ctx.engine == dm_kdialog) {
+      command.text("kdialog ").
+      text(question_cancel ? "--yesnocancel" : "--yesno").text(" \"").escaped(str_text).text("\" ").
+      text("--yes-label \"").escaped(ctx.btn_array[BUTTON_YES]).text("\" --no-label \"").escaped(ctx.btn_array[BUTTON_NO]).text("\" ").text("--title \"").escaped(ctx.caption).text("\" ").icon(ctx).text(";").
+      text("x=$? ;if [ $x = 0 ] ;then echo 1;elif [ $x = 1 ] ;then echo 0;elif [ $x = 2 ] ;then echo -1;fi");
+    }
+  }
+  else if (tpl.type == DIALOG_ATTEMPT) {
+    if (ctx.engine == dm_zenity) {
+      command.text("ans=$(zenity ").
+      text("--question --ok-label=\"").escaped(ctx.btn_array[BUTTON_RETRY]).text("\" --cancel-label=\"").escaped(ctx.btn_array[BUTTON_CANCEL]).text("\" ").text("--title=\"").
+      escaped(ctx.caption).text("\" --no-wrap --text=\"").escaped(str_text).
+      text("\" --icon-name=dialog-error ").icon(ctx).text(");if [ $? = 0 ] ;then echo 0;else echo -1;fi");
+    }
+    else if (ctx.engine == dm_kdialog) {
+      command.text("kdialog ").
+      text("--warningyesno").text(" \"").escaped(str_text).text("\" ").
+      text("--yes-label \"").escaped(ctx.btn_array[BUTTON_RETRY]).text("\" --no-label \"").escaped(ctx.btn_array[BUTTON_CANCEL]).text("\" ").text("--title \"").
+      escaped(ctx.caption).text("\" ").icon(ctx).text(";").text("x=$? ;if [ $x = 0 ] ;then echo 0;else echo -1;fi");
+    }
+  }
+  else if (tpl.type == DIALOG_ERROR || tpl.type == DIALOG_ERROR_ABORT) {
+    bool abort = (tpl.type == DIALOG_ERROR_ABORT);
+
+    if (ctx.engine == dm_zenity) {
+      const char *str_echo = abort ? "echo 1" : "if [ $? = 0 ] ;then echo 1;else echo -1;fi";
+
+      if (abort) {
+        command.text("ans=$(zenity ").
+        text("--info --ok-label=\"").escaped(ctx.btn_array[BUTTON_ABORT]).text("\" ");
+      } else {
+        command.text("ans=$(zenity ").
+        text("--question --ok-label=\"").escaped(ctx.btn_array[BUTTON_ABORT]).text("\" --cancel-label=\"").escaped(ctx.btn_array[BUTTON_IGNORE]).text("\" ");
+      }
+
+      command.text("--title=\"").escaped(ctx.caption).text("\" --no-wrap --text=\"").
+      escaped(str_text).text("\" --icon-name=dialog-error ").icon(ctx).text(");").text(str_echo);
+    }
+    else if (ctx.engine == dm_kdialog) {
+      const char *str_echo = abort ? "echo 1" : "x=$? ;if [ $x = 0 ] ;then echo 1;elif [ $x = 1 ] ;then echo -1;fi";
+
+      if (abort) {
+        command.text("kdialog ").
+        text("--sorry \"").escaped(str_text).text("\" ").
+        text("--ok-label \"").escaped(ctx.btn_array[BUTTON_ABORT]).text("\" ");
+      } else {
+        command.text("kdialog ").
+        text("--warningyesno \"").escaped(str_text).text("\" ").
+        text("--yes-label \"").escaped(ctx.btn_array[BUTTON_ABORT]).text("\" --no-label \"").escaped(ctx.btn_array[BUTTON_IGNORE]).text("\" ");
+      }
+
+      command.text("--title \"").escaped(ctx.caption).text("\" ").icon(ctx).text(";").text(str_echo);
+    }
+  }
+  else if (tpl.type == DIALOG_GET_STRING || tpl.type == DIALOG_GET_PASSWORD) {
+    bool hidden = (tpl.type == DIALOG_GET_PASSWORD);
+
+    if (ctx.engine == dm_zenity) {
+      command.text("ans=$(zenity ").
+      text("--entry --title=\"").escaped(ctx.caption).text("\"").icon(ctx).text(" --text=\"").
+      escaped(str_text).text(hidden ? "\" --hide-text --entry-text=\"" : "\" --entry-text=\"").
+      escaped(str_def).text("\");echo $ans");
+    }
+    else if (ctx.engine == dm_kdialog) {
+      command.text("ans=$(kdialog ").
+      text(hidden ? "--password \"" : "--inputbox \"").escaped(str_text).text("\" \"").
+      escaped(str_def).text("\" --title \"").
+      escaped(ctx.caption).text("\"").icon(ctx).text(");echo $ans");
+    }
+  }
+
+  return command.finish();
+}
+
+const string &file_command(const dialog_template &tpl, char *fname, char *dir) {
+  trace_scope scope(phase_build);
+  const dialog_context &ctx = tpl.ctx;
+  command_builder &command = command_begin();
+
+  if (tpl.type == DIALOG_DIRECTORY) {
+    const char *str_end = ");if [ $ans = / ] ;then echo $ans;elif [ $? = 1 ] ;then echo $ans/;else echo $ans;fi";
+
+    if (ctx.engine == dm_zenity) {
+      command.text("ans=$(zenity ").
+      text("--file-selection --directory --title=\"").escaped(ctx.caption).text("\" --filename=\"").
+      path(fname).text("\"").icon(ctx).text(str_end);
+    }
+    else if (ctx.engine == dm_kdialog) {
+      command.text("ans=$(kdialog ").
+      text("--getexistingdirectory ").text("\"$PWD/\"");
+      if (fname[0] != '\0' && fname[0] != '/')
+        command.text("\"").path(fname).text("\"");
+      command.text(" --title \"").escaped(ctx.caption).text("\"").icon(ctx).text(str_end);
+    }
+
+    return command.finish();
+  }
+
+  string str_fname = filename_name(filename_absolute(fname));
+  string str_dir = filename_absolute(dir);
+
+  // the directory joined to the file's name, or the name as given
+  bool joined = (str_dir[0] != '\0');
+  const char *str_path = joined ? str_dir.c_str() : fname;
+  auto full_path = [&]() -> command_builder & {
+    if (joined) return command.path(str_dir).text("/").path(str_fname);
+    return command.path(fname);
+  };
+
+  if (ctx.engine == dm_zenity) {
+    if (tpl.type == DIALOG_OPEN_FILENAME) {
+      command.text("ans=$(zenity ").
+      text("--file-selection --title=\"").escaped(ctx.caption).text("\" --filename=\"");
+      full_path().text("\"").text(tpl.str_filter).icon(ctx).text(");echo $ans");
+    }
+    else if (tpl.type == DIALOG_OPEN_FILENAMES) {
+      command.text("zenity ").
+      text("--file-selection --multiple --separator='\n' --title=\"").escaped(ctx.caption).text("\" --filename=\"");
+      full_path().text("\"").text(tpl.str_filter).icon(ctx);
+    }
+    else if (tpl.type == DIALOG_SAVE_FILENAME) {
+      command.text("ans=$(zenity ").
+      text("--file-selection  --save --confirm-overwrite --title=\"").escaped(ctx.caption).text("\" --filename=\"");
+      full_path().text("\"").text(tpl.str_filter).icon(ctx).text(");echo $ans");
+    }
+  }
+  else if (ctx.engine == dm_kdialog) {
+    if (tpl.type == DIALOG_OPEN_FILENAME || tpl.type == DIALOG_OPEN_FILENAMES)
+      command.text((tpl.type == DIALOG_OPEN_FILENAME) ? "ans=$(kdialog " : "kdialog ").text("--getopenfilename ");
+    else if (tpl.type == DIALOG_SAVE_FILENAME)
+      command.text("ans=$(kdialog ").text("--getsavefilename ");
+    else return command.finish();
+
+    command.text("\"$PWD/\"");
+    if (str_path[0] != '\0' && str_path[0] != '/') {
+      command.text("\"");
+      full_path().text("\"");
+    }
+    command.text(tpl.str_filter);
+
+    if (tpl.type == DIALOG_OPEN_FILENAMES)
+      command.text(" --multiple --separate-output --title \"").escaped(ctx.caption).text("\"").icon(ctx);
+    else
+      command.text(" --title \"").escaped(ctx.caption).text("\"").icon(ctx).text(");echo $ans");
+  }
+
+  return command.finish();
+}
+
+int message_result(int type, string str_result) {
+  double result = strtod(str_result.c_str(), nullptr);
+  if ((type == DIALOG_ERROR || type == DIALOG_ERROR_ABORT) && result == 1) exit(0);
+  return (int)result;
+}
+
+string file_result(int type, string result) {
+  if (type == DIALOG_OPEN_FILENAME) {
+    if (file_exists(result))
+      return result;
+    return "";
+  }
+
+  if (type == DIALOG_OPEN_FILENAMES) {
+    std::vector<string> stringVec = string_split(result, '\n');
+    for (const string &str : stringVec) {
+      if (!file_exists(str))
+        return "";
+    }
+  }
+
+  return result;
+}
+
+int show_message_helperfunc(int type, char *str) {
+  metrics_dialog(type);
+  dialog_template tpl = make_template(type, nullptr, nullptr);
+  if (tpl.ctx.gtk) return message_result(type, gtk_message(tpl.ctx, type, utf8_text(str), ""));
+  string result;
+  if (daemon_message(tpl.ctx, type, str, "", result)) return message_result(type, result);
+  const string &str_command = message_command(tpl, str, "");
+  return message_result(type, shellscript_evaluate(str_command, tpl.ctx));
+}
+
+char *get_string_helperfunc(int type, char *str, char *def) {
+  metrics_dialog(type);
+  dialog_template tpl = make_template(type, nullptr, nullptr);
+  thread_local string result;
+  if (tpl.ctx.gtk) {
+    result = gtk_message(tpl.ctx, type, utf8_text(str), utf8_text(def));
+    return (char *)result.c_str();
+  }
+  if (daemon_message(tpl.ctx, type, str, def, result))
+    return (char *)result.c_str();
+  const string &str_command = message_command(tpl, str, def);
+  result = shellscript_evaluate(str_command, tpl.ctx);
+  return (char *)result.c_str();
+}
+
+char *get_filename_helperfunc(int type, char *filter, char *fname, char *dir, char *title) {
+  metrics_dialog(type);
+  dialog_template tpl = make_template(type, title, filter);
+  thread_local string result;
+  if (tpl.ctx.gtk) {
+    result = file_result(type, gtk_file(tpl, fname, dir));
+    return (char *)result.c_str();
+  }
+  if ((tpl.ctx.portal && portal_file(tpl, fname, dir, result)) || daemon_file(tpl, fname, dir, result)) {
+    result = file_result(type, result);
+    return (char *)result.c_str();
+  }
+  const string &str_command = file_command(tpl, fname, dir);
+  result = file_result(type, shellscript_evaluate(str_command, tpl.ctx));
+  return (char *)result.c_str();
+}
+
+struct form_field {
+  string label;
+  string type;
+  vector<string> values;
+};
+
+// "Label|type|Label|type..." where type is text, password, integer or
+// combo:first;second;third, the same way filters pair names and patterns
+vector<form_field> form_fields(string input) {
+  input = string_replace_all(input, "\r", "");
+  input = string_replace_all(input, "\n", "");
+  std::vector<string> stringVec = string_split(input, '|');
+  vector<form_field> fields;
+
+  for (size_t i = 0; i < stringVec.size(); i += 2) {
+    form_field field;
+    field.label = stringVec[i];
+    field.type = (i + 1 < stringVec.size()) ? stringVec[i + 1] : "text";
+    if (field.type.compare(0, 6, "combo:") == 0) {
+      field.values = string_split(field.type.substr(6), ';');
+      field.type = "combo";
+    }
+    fields.push_back(field);
+  }
+
+  return fields;
+}
+
+const string &form_command(const dialog_context &ctx, const char *str_text, const vector<form_field> &fields) {
+  command_builder &command = command_begin();
+
+  if (ctx.engine == dm_zenity) {
+    // one zenity process shows every field
+    command.text("zenity ").
+    text("--forms --separator='\n' --title=\"").escaped(ctx.caption).text("\" --text=\"").escaped(str_text).text("\"");
+
+    for (const form_field &field : fields) {
+      if (field.type == "password") {
+        command.text(" --add-password=\"").escaped(field.label).text("\"");
+      } else if (field.type == "combo") {
+        command.text(" --add-combo=\"").escaped(field.label).text("\" --combo-values=\"");
+        // the separator only goes in once some value has come out non-empty
+        bool values_empty = true;
+        for (const string &value : field.values) {
+          if (!values_empty) command.text("|");
+          command.escaped(value);
+          values_empty = values_empty && value.empty();
+        }
+        command.text("\"");
+      } else {
+        command.text(" --add-entry=\"").escaped(field.label).text("\"");
+      }
+    }
+
+    command.icon(ctx).text(";echo $?");
+  }
+  else if (ctx.engine == dm_kdialog) {
+    // kdialog has no forms, so ask for each field in turn from the same shell
+    for (size_t i = 0; i < fields.size(); i++) {
+      const form_field &field = fields[i];
+      command.text("f").number(i);
+
+      if (field.type == "password") command.text("=$(kdialog --password \"");
+      else if (field.type == "combo") command.text("=$(kdialog --combobox \"");
+      else command.text("=$(kdialog --inputbox \"");
+
+      if (i == 0 && str_text[0] != '\0') command.escaped(str_text).text("\n\n");
+      command.escaped(field.label).text("\"");
+
+      if (field.type == "combo") {
+        for (const string &value : field.values)
+          command.text(" \"").escaped(value).text("\"");
+      } else if (field.type != "password") {
+        command.text(" \"\"");
+      }
+
+      command.text(" --title \"").escaped(ctx.caption).text("\"").icon(ctx).text(") || { echo 1;exit; };");
+    }
+
+    command.text("printf '%s\\n'");
+    for (size_t i = 0; i < fields.size(); i++)
+      command.text(" \"$f").number(i).text("\"");
+    command.text(" 0");
+  }
+
+  return command.finish();
+}
+
+// both engines print the fields a line each and then the exit status, so
+// a form whose last fields were left empty is not mistaken for a cancel
+string form_result(const vector<form_field> &fields, string result) {
+  size_t pos = result.rfind('\n');
+  string status = (pos == string::npos) ? result : result.substr(pos + 1);
+  if (fields.empty() || status != "0")
+    return "";
+
+  // string_split() would drop the empty fields at the end
+  std::vector<string> stringVec;
+  result = (pos == string::npos) ? "" : result.substr(0, pos);
+  for (size_t start = 0;;) {
+    size_t end = result.find('\n', start);
+    stringVec.push_back(result.substr(start, end - start));
+    if (end == string::npos) break;
+    start = end + 1;
+  }
+  if (stringVec.size() < fields.size())
+    return "";
+
+  string str_result;
+  for (size_t i = 0; i < fields.size(); i++) {
+    string value = stringVec[i];
+    if (fields[i].type == "integer") {
+      double DIGITS_MIN = -999999999999999;
+      double DIGITS_MAX = 999999999999999;
+      double numb = strtod(value.c_str(), nullptr);
+      if (numb < DIGITS_MIN) numb = DIGITS_MIN;
+      if (numb > DIGITS_MAX) numb = DIGITS_MAX;
+      value = remove_trailing_zeros(numb);
+    }
+    str_result += (i ? "\n" : "") + value;
+  }
+
+  return str_result;
+}
+
+std::mutex prepared_mutex;
+std::map<int, std::shared_ptr<const dialog_template>> prepared_dialogs;
+int prepared_id = 0;
+
+std::shared_ptr<const dialog_template> prepared_find(int id) {
+  std::lock_guard<std::mutex> lock(prepared_mutex);
+  std::map<int, std::shared_ptr<const dialog_template>>::iterator found = prepared_dialogs.find(id);
+  return (found != prepared_dialogs.end()) ? found->second : nullptr;
+}
+
+// runs a program with its arguments passed through as they are, so nothing
+// needs escaping, and returns its output; with a context the program is
+// started below a shell so modify_dialog() can find and decorate its window
+string program_evaluate(vector<string> args, const dialog_context *ctx) {
+  if (ctx) DLGMOD_PROBE1(dialog__start, args[0].c_str());
+  if (ctx) args.insert(args.begin(), { "/bin/sh", "-c", "\"$@\";exit $?", "sh" });
+  vector<char *> argv;
+  for (string &arg : args)
+    argv.push_back((char *)arg.c_str());
+  argv.push_back(nullptr);
+  int fd[2];
+  if (pipe2(fd, O_CLOEXEC) == -1) return "";
+  trace_scope scope(phase_dialog);
+  process_t child = 0;
+  {
+    trace_scope spawn(phase_spawn);
+    child = fork();
+    if (child == 0) {
+      dup2(fd[1], STDOUT_FILENO);
+      execvp(argv[0], argv.data());
+      _exit(127);
+    }
+    if (child > 0) metrics_count(metric_spawns);
+    DLGMOD_PROBE2(engine__spawn, (int)child, argv[0]);
+  }
+  close(fd[1]);
+  process_t pid = (ctx && child > 0) ? modify_dialog(child, *ctx) : 0;
+  trace_wait(fd[0]);
+  string result;
+  {
+    trace_scope drain(phase_drain);
+    result = descriptor_read(fd[0]);
+    close(fd[0]);
+    metrics_count(metric_pipe_bytes, result.length());
+  }
+  {
+    trace_scope reap(phase_reap);
+    int status;
+    if (child > 0) {
+      waitpid(child, &status, 0);
+      DLGMOD_PROBE2(child__reaped, (int)child, status);
+    }
+  }
+  modify_dialog_reap(pid);
+  if (!result.empty() && result.back() == '\n')
+    result.pop_back();
+  if (ctx) DLGMOD_PROBE1(dialog__end, result.c_str());
+  return result;
+}
+
+// starts a program without waiting on it; it is run from a child that exits
+// at once, so it never becomes a zombie of ours
+void program_detach(vector<string> args) {
+  vector<char *> argv;
+  for (string &arg : args)
+    argv.push_back((char *)arg.c_str());
+  argv.push_back(nullptr);
+  process_t child = fork();
+  if (child == 0) {
+    if (fork() == 0) {
+      execvp(argv[0], argv.data());
+      _exit(127);
+    }
+    _exit(0);
+  }
+  int status;
+  if (child > 0) {
+    metrics_count(metric_spawns);
+    waitpid(child, &status, 0);
+  }
+}
+
+// the same for a helper such as qdbus that is no dialog of its own, so it
+// stays out of the dialog phases, spawn counts and probes
+string helper_evaluate(vector<string> args) {
+  vector<char *> argv;
+  for (string &arg : args)
+    argv.push_back((char *)arg.c_str());
+  argv.push_back(nullptr);
+  int fd[2];
+  if (pipe2(fd, O_CLOEXEC) == -1) return "";
+  process_t child = fork();
+  if (child == 0) {
+    dup2(fd[1], STDOUT_FILENO);
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  close(fd[1]);
+  string result = descriptor_read(fd[0]);
+  close(fd[0]);
+  int status;
+  if (child > 0) waitpid(child, &status, 0);
+  if (!result.empty() && result.back() == '\n')
+    result.pop_back();
+  return result;
+}
+
+// progress dialogs live in a fixed table so progress_update() is nothing more
+// than an atomic store; a writer thread per dialog forwards the latest value
+// to the engine once per frame and drops whatever happened in between.
+// kdialog takes every update as a qdbus process of its own, so it only gets
+// one every few frames, and is asked whether it was cancelled less often
+int const progress_max = 16;
+std::chrono::milliseconds const progress_frame(16);
+unsigned const progress_kdialog_frames = 6;
+unsigned const progress_cancel_frames = 32;
+
+enum PROGRESS_STATES {
+  PROGRESS_FREE,
+  PROGRESS_OPENING,
+  PROGRESS_OPEN,
+  PROGRESS_CLOSING
+};
+
+struct progress_dialog {
+  std::atomic<int> state{PROGRESS_FREE};
+  std::atomic<bool> alive{false};
+  std::atomic<double> value{0};
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool closing = false;
+  string text;
+  unsigned text_serial = 0;
+  dialog_context ctx;
+  // zenity reads its updates from a socket on stdin
+  int fd = -1;
+  process_t shell = 0;
+  process_t decorator = 0;
+  // kdialog is driven over D-Bus
+  string service;
+  string path;
+  std::thread writer;
+};
+
+// never destroyed, since a dialog still open at exit has a writer thread
+// that ~thread() would call std::terminate() over
+progress_dialog *progress_dialogs = new progress_dialog[progress_max];
+
+progress_dialog *progress_find(int id) {
+  if (id < 0 || id >= progress_max) return nullptr;
+  return &progress_dialogs[id];
+}
 
-  if (message_cancel)
-    str_echo = "if [ $? = 0 ] ;then echo 1;else echo -1;fi";
+int progress_percent(double value) {
+  if (!(value > 0)) return 0;
+  if (value > 100) return 100;
+  return (int)value;
+}
 
-  if (dm_dialogengine == dm_zenity) {
-    string str_icon_2 = string("\" --icon-name=dialog-information") + str_icon + string(");");
-    str_cancel = string("--info --ok-label=\"") + add_escaping(btn_array[BUTTON_OK], true, "") + string("\" ");
+string progress_kdialog(progress_dialog *dlg, string method, vector<string> args) {
+  vector<string> command = { "qdbus", dlg->service, dlg->path, method };
+  command.insert(command.end(), args.begin(), args.end());
+  return helper_evaluate(command);
+}
 
-    if (message_cancel) {
-      str_icon_2 = string("\" --icon-name=dialog-question") + str_icon + string(");");
-      str_cancel = string("--question --ok-label=\"") + add_escaping(btn_array[BUTTON_OK], true, "") + string("\" --cancel-label=\"") + add_escaping(btn_array[BUTTON_CANCEL], true, "") + string("\" ");
+void progress_write(progress_dialog *dlg) {
+  string text, pending;
+  unsigned text_serial = 0;
+  int percent = 0;
+  bool text_dirty = false, percent_dirty = false;
+  for (unsigned frame = 1; dlg->alive.load(std::memory_order_relaxed); frame++) {
+    {
+      std::unique_lock<std::mutex> lock(dlg->mutex);
+      dlg->wake.wait_for(lock, progress_frame, [dlg] { return dlg->closing; });
+      if (dlg->closing) break;
+      if (dlg->text_serial != text_serial) {
+        text_serial = dlg->text_serial;
+        text = dlg->text;
+        text_dirty = true;
+      }
+    }
+    int next = progress_percent(dlg->value.load(std::memory_order_relaxed));
+    if (next != percent) {
+      percent = next;
+      percent_dirty = true;
     }
+    if (dlg->ctx.engine == dm_zenity) {
+      if (pending.empty()) {
+        if (text_dirty) pending += string("# ") + string_replace_all(text, "\n", " ") + string("\n");
+        if (percent_dirty) pending += to_string(percent) + string("\n");
+        text_dirty = percent_dirty = false;
+      }
+      if (dlg->ctx.mock) {
+        pending.clear();
+        continue;
+      }
+      if (!socket_send(dlg->fd, pending, false))
+        dlg->alive.store(false, std::memory_order_relaxed);
+      int status;
+      if (waitpid(dlg->shell, &status, WNOHANG) == dlg->shell) {
+        dlg->shell = 0;
+        dlg->alive.store(false, std::memory_order_relaxed);
+      }
+    } else if (dlg->ctx.engine == dm_kdialog) {
+      // anything dirty waits for the next update frame and goes out then
+      if (frame % progress_kdialog_frames == 0) {
+        if (text_dirty) progress_kdialog(dlg, "setLabelText", { text });
+        if (percent_dirty) progress_kdialog(dlg, "Set", { "", "value", to_string(percent) });
+        text_dirty = percent_dirty = false;
+      }
+      if (frame % progress_cancel_frames == 0 && progress_kdialog(dlg, "wasCancelled", {}) != "false")
+        dlg->alive.store(false, std::memory_order_relaxed);
+    }
+  }
+}
 
-    str_command = string("ans=$(zenity ") +
-    str_cancel + string("--title=\"") + str_title + string("\" --no-wrap --text=\"") +
-    add_escaping(str, false, "") + str_icon_2 + str_echo;
+bool progress_start(progress_dialog *dlg) {
+  const dialog_context &ctx = dlg->ctx;
+
+  if (ctx.engine == dm_zenity) {
+    int fd[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fd) == -1) return false;
+    const string &str_command = command_begin().text("zenity --progress --title=\"").escaped(ctx.caption).
+    text("\" --text=\"").escaped(dlg->text).text("\" --percentage=0").icon(ctx).text(";exit $?").finish();
+    if (ctx.mock) {
+      close(fd[0]);
+      close(fd[1]);
+      return true;
+    }
+    process_t ppid = process_spawn(str_command, fd[1], -1, true);
+    close(fd[1]);
+    if (ppid == -1) {
+      close(fd[0]);
+      return false;
+    }
+    dlg->fd = fd[0];
+    dlg->shell = ppid;
+    dlg->decorator = modify_dialog(ppid, ctx);
+    return true;
+  }
+  else if (ctx.engine == dm_kdialog) {
+    // kdialog detaches the dialog and prints the D-Bus service and path to reach it
+    const string &str_command = command_begin().text("kdialog --progressbar \"").escaped(dlg->text).
+    text("\" 100 --title \"").escaped(ctx.caption).text("\"").icon(ctx).finish();
+    char *buffer = nullptr;
+    size_t buffer_size = 0;
+    process_t ppid = 0;
+    FILE *file = process_open(str_command, &ppid);
+    if (!file) return false;
+    string reference;
+    if (getline(&buffer, &buffer_size, file) != -1)
+      reference = buffer;
+    free(buffer);
+    fclose(file);
+    int status;
+    waitpid(ppid, &status, 0);
+    vector<string> stringVec = string_split(string_replace_all(reference, "\n", ""), ' ');
+    if (stringVec.size() < 2) return false;
+    dlg->service = stringVec[0];
+    dlg->path = stringVec[1];
+    progress_kdialog(dlg, "showCancelButton", { "true" });
+    return true;
   }
-  else if (dm_dialogengine == dm_kdialog) {
-    str_cancel = string("--msgbox \"") + add_escaping(str, false, "") + string("\" --ok-label \"") + add_escaping(btn_array[BUTTON_OK], true, "") + string("\"") + str_icon + string(" ");
 
-    if (message_cancel)
-      str_cancel = string("--yesno \"") + add_escaping(str, false, "") + string("\" --yes-label \"") + add_escaping(btn_array[BUTTON_OK], true, "") + string("\" --no-label \"") + add_escaping(btn_array[BUTTON_CANCEL], true, "") + string("\"") + str_icon + string(" ");
+  return false;
+}
 
-    str_command = string("kdialog ") +
-    str_cancel + string("--title \"") + str_title + string("\";") + str_echo;
+void progress_stop(progress_dialog *dlg) {
+  if (dlg->ctx.engine == dm_zenity) {
+    close(dlg->fd);
+    if (dlg->shell > 0) {
+      int status;
+      kill(-dlg->shell, SIGTERM);
+      waitpid(dlg->shell, &status, 0);
+    }
+    modify_dialog_reap(dlg->decorator);
+  } else if (dlg->ctx.engine == dm_kdialog) {
+    progress_kdialog(dlg, "close", {});
   }
+  dlg->fd = -1;
+  dlg->shell = 0;
+  dlg->decorator = 0;
+  dlg->service = "";
+  dlg->path = "";
+}
 
-  string str_result = shellscript_evaluate(str_command);
-  caption = caption_previous;
-  double result = strtod(str_result.c_str(), nullptr);
-  return (int)result;
+// rows are written out in batches of about this many bytes
+size_t const list_batch = 65536;
+
+void list_append(string &batch, const char *row) {
+  for (const char *ch = row; *ch; ch++)
+    batch += (*ch == '\n' || *ch == '\r') ? ' ' : *ch;
+  batch += '\n';
 }
 
-int show_question_helperfunc(char *str) {
-  change_relative_to_kwin();
-  string str_command;
-  string str_title = add_escaping(caption, true, "Question");
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
-  string caption_previous = caption;
-  caption = (str_title == "Question") ? "Question" : caption;
-  string str_cancel = "";
+// zenity reads the rows from stdin while the list is already on screen, so
+// they are pulled from the iterator only as fast as the dialog takes them
+string list_zenity(const dialog_context &ctx, const char *str_text, const char *str_column, list_next_t next, void *data) {
+  const string &str_command = command_begin().text("zenity --list --title=\"").escaped(ctx.caption).
+  text("\" --text=\"").escaped(str_text).text("\" --column=\"").escaped(str_column).text("\"").icon(ctx).text(";exit $?").finish();
+  DLGMOD_PROBE1(dialog__start, str_command.c_str());
+  if (ctx.mock) {
+    // the rows are still all taken, as the dialog would have
+    string batch;
+    for (const char *row; (row = next(data)); batch.clear())
+      list_append(batch, row);
+    string result = mock_evaluate();
+    DLGMOD_PROBE1(dialog__end, result.c_str());
+    return result;
+  }
+  int in[2], out[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, in) == -1) return "";
+  if (pipe2(out, O_CLOEXEC) == -1) {
+    close(in[0]); close(in[1]);
+    return "";
+  }
+  process_t ppid = process_spawn(str_command, in[1], out[1], false);
+  close(in[1]); close(out[1]);
+  if (ppid == -1) {
+    close(in[0]); close(out[0]);
+    return "";
+  }
+  process_t pid = modify_dialog(ppid, ctx);
+  string batch;
+  batch.reserve(list_batch + PATH_MAX);
+  // a dialog that closes early stops the iterator as well
+  bool open = true;
+  while (open) {
+    const char *row = next(data);
+    if (row) list_append(batch, row);
+    if (!row || batch.length() >= list_batch)
+      open = socket_send(in[0], batch, true) && row;
+  }
+  close(in[0]);
+  string result = descriptor_read(out[0]);
+  close(out[0]);
+  metrics_count(metric_pipe_bytes, result.length());
+  int status;
+  waitpid(ppid, &status, 0);
+  DLGMOD_PROBE2(child__reaped, (int)ppid, status);
+  modify_dialog_reap(pid);
+  if (!result.empty() && result.back() == '\n')
+    result.pop_back();
+  DLGMOD_PROBE1(dialog__end, result.c_str());
+  return result;
+}
 
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
+// the rows go straight from the iterator into the model on the GUI thread,
+// and the view is only made once the model is full
+string list_gtk(const dialog_context &ctx, const char *str_text, const char *str_column, list_next_t next, void *data) {
+  string result;
+  gtk_invoke([&]() {
+    void *store = gtk.list_store_new(1, gtk_type_string);
+    gtk_tree_iter iter;
+    for (const char *row; (row = next(data));) {
+      gtk.list_store_append(store, &iter);
+      gtk.list_store_set(store, &iter, 0, row, -1);
+    }
+    void *dialog = gtk.message_dialog_new(nullptr, 1, 2, 0, "%s", str_text);
+    gtk_decorate(dialog, ctx);
+    gtk.dialog_add_button(dialog, ctx.btn_array[BUTTON_CANCEL].c_str(), gtk_response_cancel);
+    gtk.dialog_add_button(dialog, ctx.btn_array[BUTTON_OK].c_str(), gtk_response_ok);
+    gtk.dialog_set_default_response(dialog, gtk_response_ok);
+    void *view = gtk.tree_view_new_with_model(store);
+    gtk.object_unref(store);
+    gtk.tree_view_insert_column_with_attributes(view, -1, str_column, gtk.cell_renderer_text_new(), "text", 0, nullptr);
+    void *scrolled = gtk.scrolled_window_new(nullptr, nullptr);
+    gtk.widget_set_size_request(scrolled, 400, 300);
+    gtk.container_add(scrolled, view);
+    gtk.container_add(gtk.message_dialog_get_message_area(dialog), scrolled);
+    gtk.widget_show(view);
+    gtk.widget_show(scrolled);
+    void *model = nullptr;
+    if (gtk.dialog_run(dialog) == gtk_response_ok &&
+      gtk.tree_selection_get_selected(gtk.tree_view_get_selection(view), &model, &iter)) {
+      char *row = nullptr;
+      gtk.tree_model_get(model, &iter, 0, &row, -1);
+      if (row) result = row;
+      gtk.free(row);
+    }
+    gtk.widget_destroy(dialog);
+  });
+  return result;
+}
 
-  if (dm_dialogengine == dm_zenity) {
-    if (question_cancel)
-      str_cancel = string("--extra-button=\"") + add_escaping(btn_array[BUTTON_CANCEL], true, "") + string("\" ");
+// the rows list_kdialog() already took, then the rest from the caller
+struct list_replay {
+  const vector<string> *args;
+  size_t index;
+  list_next_t next;
+  void *data;
+};
 
-    str_command = string("ans=$(zenity ") +
-    string("--question --ok-label=\"") + add_escaping(btn_array[BUTTON_YES], true, "") + string("\" --cancel-label=\"") + add_escaping(btn_array[BUTTON_NO], true, "") + string("\" ") + str_cancel +  string("--title=\"") +
-    str_title + string("\" --no-wrap --text=\"") + add_escaping(str, false, "") +
-    string("\" --icon-name=dialog-question") + str_icon + string(");if [ $? = 0 ] ;then echo 1;elif [ $ans = \"") + btn_array[BUTTON_CANCEL] + string("\" ] ;then echo -1;else echo 0;fi");
+const char *list_replay_next(void *data) {
+  list_replay *replay = (list_replay *)data;
+  if (replay->index < replay->args->size()) {
+    const char *row = (*replay->args)[replay->index].c_str();
+    replay->index += 2;
+    return row;
   }
-  else if (dm_dialogengine == dm_kdialog) {
-    if (question_cancel)
-      str_cancel = "cancel";
+  return replay->next(replay->data);
+}
 
-    str_command = string("kdialog ") +
-    string("--yesno") + str_cancel + string(" \"") + add_escaping(str, false, "") + string("\" ") +
-    string("--yes-label \"") + add_escaping(btn_array[BUTTON_YES], true, "") + string("\" --no-label \"") + add_escaping(btn_array[BUTTON_NO], true, "") + string("\" ") + string("--title \"") + str_title + string("\" ") + str_icon + string(";") +
-    string("x=$? ;if [ $x = 0 ] ;then echo 1;elif [ $x = 1 ] ;then echo 0;elif [ $x = 2 ] ;then echo -1;fi");
+// linux's MAX_ARG_STRLEN: no one argument may be longer, whatever ARG_MAX is
+size_t const list_argument_max = 131072;
+
+// kdialog only takes menu items as arguments, so they are gathered up and
+// handed to it directly instead of through a shell command line. the kernel
+// only takes so much of that, and half of ARG_MAX is left to the environment;
+// a list that grows past it goes to the GTK engine, or failing that to
+// zenity, with the rows taken so far and the rest of the iterator
+string list_kdialog(const dialog_context &ctx, const char *str_text, const char *str_column, list_next_t next, void *data) {
+  long arg_max = sysconf(_SC_ARG_MAX);
+  size_t budget = (arg_max > 0) ? (size_t)arg_max / 2 : list_argument_max;
+  vector<string> args = { "kdialog", "--menu", str_text };
+  size_t used = 0;
+  size_t count = 0;
+  for (const char *row; (row = next(data)); count++) {
+    args.push_back(to_string(count));
+    args.push_back(row);
+    size_t length = args.back().length();
+    used += args[args.size() - 2].length() + length + 2 + 2 * sizeof(char *);
+    if (length >= list_argument_max || used > budget) {
+      list_replay replay = { &args, 4, next, data };
+      if (gtk_load()) return list_gtk(ctx, str_text, str_column, list_replay_next, &replay);
+      dialog_context zenity = ctx;
+      zenity.engine = dm_zenity;
+      return list_zenity(zenity, str_text, str_column, list_replay_next, &replay);
+    }
   }
+  args.push_back("--title");
+  args.push_back(ctx.caption);
+  if (file_exists(ctx.icon)) {
+    args.push_back("--icon");
+    args.push_back(ctx.icon);
+  }
+  string result = program_evaluate(args, &ctx);
+  if (result.empty()) return "";
+  // the item after the tag that was picked
+  size_t index = strtoul(result.c_str(), nullptr, 10);
+  return (index < count) ? args[4 + 2 * index] : "";
+}
 
-  string str_result = shellscript_evaluate(str_command);
-  caption = caption_previous;
-  double result = strtod(str_result.c_str(), nullptr);
-  return (int)result;
+struct list_file {
+  FILE *file;
+  char *buffer;
+  size_t buffer_size;
+};
+
+const char *list_file_next(void *data) {
+  list_file *lf = (list_file *)data;
+  ssize_t length = getline(&lf->buffer, &lf->buffer_size, lf->file);
+  if (length == -1) return nullptr;
+  if (length && lf->buffer[length - 1] == '\n')
+    lf->buffer[length - 1] = '\0';
+  return lf->buffer;
+}
+
+// moves everything from fd into the pipe without it passing through our
+// memory; splice() handles files and pipes alike, sendfile() and a plain
+// copy cover the sources it refuses. SIGPIPE is held back for the calling
+// thread so a viewer closed early only ends the transfer
+bool text_feed(int fd, int pipe_out) {
+  sigset_t sigpipe, previous;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &previous);
+  bool success = true, use_splice = true, use_sendfile = true;
+  char buffer[4096];
+  for (;;) {
+    ssize_t moved = -1;
+    if (use_splice) {
+      moved = splice(fd, nullptr, pipe_out, nullptr, 1 << 20, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (moved == -1 && errno == EINVAL) { use_splice = false; continue; }
+    } else if (use_sendfile) {
+      moved = sendfile(pipe_out, fd, nullptr, 1 << 20);
+      if (moved == -1 && (errno == EINVAL || errno == ENOSYS)) { use_sendfile = false; continue; }
+    } else {
+      moved = read(fd, buffer, sizeof(buffer));
+      for (ssize_t done = 0, count; moved > 0 && done < moved; done += count) {
+        while ((count = write(pipe_out, buffer + done, moved - done)) == -1 && errno == EINTR);
+        if (count == -1) { moved = -1; break; }
+      }
+    }
+    if (moved == -1 && errno == EINTR) continue;
+    if (moved <= 0) {
+      success = (moved == 0);
+      break;
+    }
+  }
+  // a pending SIGPIPE is ours, take it before unblocking
+  struct timespec none = { 0, 0 };
+  if (!sigismember(&previous, SIGPIPE))
+    while (sigtimedwait(&sigpipe, nullptr, &none) == SIGPIPE);
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+  return success;
+}
+
+// notifications are queued and handed to the engine in batches by a single
+// sender thread: a burst is collected for a moment, repeats are counted
+// instead of shown again, and batches go out at most once per interval
+std::chrono::milliseconds const notify_gather(50);
+std::chrono::milliseconds const notify_interval(1000);
+unsigned const notify_lines = 5;
+
+struct notify_state {
+  std::mutex mutex;
+  std::condition_variable wake;
+  vector<string> queue;
+  bool started = false;
+  // long-lived zenity --notification --listen child
+  int fd = -1;
+  process_t pid = 0;
+};
+
+// never destroyed, so the sender thread can outlive static destructors
+notify_state *notifier = new notify_state;
+
+vector<string> notify_coalesce(const vector<string> &batch) {
+  vector<string> lines;
+  vector<unsigned> counts;
+  std::unordered_map<string, size_t> index;
+  for (const string &str : batch) {
+    std::unordered_map<string, size_t>::iterator found = index.find(str);
+    if (found != index.end()) { counts[found->second]++; continue; }
+    index[str] = lines.size();
+    lines.push_back(str);
+    counts.push_back(1);
+  }
+  for (size_t i = 0; i < lines.size(); i++)
+    if (counts[i] > 1) lines[i] += string(" (") + to_string(counts[i]) + string(")");
+  if (lines.size() > notify_lines) {
+    size_t more = lines.size() - (notify_lines - 1);
+    lines.resize(notify_lines - 1);
+    lines.push_back(string("and ") + to_string(more) + string(" more"));
+  }
+  return lines;
+}
+
+void notify_listener_stop() {
+  if (notifier->fd != -1) close(notifier->fd);
+  if (notifier->pid > 0) {
+    int status;
+    kill(-notifier->pid, SIGTERM);
+    waitpid(notifier->pid, &status, 0);
+  }
+  notifier->fd = -1;
+  notifier->pid = 0;
+}
+
+bool notify_listener_start(const dialog_context &ctx) {
+  int status;
+  if (notifier->pid > 0 && waitpid(notifier->pid, &status, WNOHANG) == 0) return true;
+  notifier->pid = 0;
+  notify_listener_stop();
+  int fd[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fd) == -1) return false;
+  int fd_null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  const string &str_command = command_begin().text("zenity --notification --listen").icon(ctx).text(";exit $?").finish();
+  process_t pid = process_spawn(str_command, fd[1], fd_null, true);
+  close(fd[1]);
+  if (fd_null != -1) close(fd_null);
+  if (pid == -1) {
+    close(fd[0]);
+    return false;
+  }
+  notifier->fd = fd[0];
+  notifier->pid = pid;
+  return true;
+}
+
+// org.freedesktop.Notifications.Notify(s app_name, u replaces_id, s app_icon,
+// s summary, s body, as actions, a{sv} hints, i expire_timeout), sent over
+// the portal's connection without asking for the id it would answer with.
+// libdbus aborts on strings that are not UTF-8, so those are left to kdialog
+bool notify_bus(const dialog_context &ctx, const string &str_text) {
+  bool invalid = false;
+  text_escape(nullptr, ctx.caption.data(), ctx.caption.length(), false, false, false, invalid);
+  text_escape(nullptr, str_text.data(), str_text.length(), false, false, false, invalid);
+  if (invalid || !portal_load()) return false;
+  void *message = dbus.message_new_method_call("org.freedesktop.Notifications",
+    "/org/freedesktop/Notifications", "org.freedesktop.Notifications", "Notify");
+  if (!message) return false;
+  // the body may be taken as markup
+  string str_body = string_replace_all(string_replace_all(string_replace_all(str_text, "&", "&amp;"), "<", "&lt;"), ">", "&gt;");
+  string str_icon = file_exists(ctx.icon) ? ctx.icon : "";
+  const char *caption = ctx.caption.c_str();
+  const char *icon = str_icon.c_str();
+  const char *body = str_body.c_str();
+  uint32_t replaces = 0;
+  int32_t timeout = 5000;
+  dbus_iter args, actions, hints;
+  dbus.message_iter_init_append(message, &args);
+  dbus.message_iter_append_basic(&args, 's', &caption);
+  dbus.message_iter_append_basic(&args, 'u', &replaces);
+  dbus.message_iter_append_basic(&args, 's', &icon);
+  dbus.message_iter_append_basic(&args, 's', &caption);
+  dbus.message_iter_append_basic(&args, 's', &body);
+  dbus.message_iter_open_container(&args, 'a', "s", &actions);
+  dbus.message_iter_close_container(&args, &actions);
+  dbus.message_iter_open_container(&args, 'a', "{sv}", &hints);
+  dbus.message_iter_close_container(&args, &hints);
+  dbus.message_iter_append_basic(&args, 'i', &timeout);
+  dbus.message_set_no_reply(message, true);
+  return portal_post(message);
+}
+
+void notify_deliver(const vector<string> &batch) {
+  dialog_context ctx = capture_context(nullptr, "Information");
+  vector<string> lines = notify_coalesce(batch);
+  if (ctx.mock) return;
+  if (ctx.engine == dm_zenity) {
+    string pending;
+    for (const string &line : lines)
+      pending += string("message:") + string_replace_all(string_replace_all(line, "\r", " "), "\n", " ") + string("\n");
+    // one retry with a fresh listener if the old one went away
+    for (unsigned attempt = 0; attempt < 2 && !pending.empty(); attempt++) {
+      if (!notify_listener_start(ctx)) break;
+      if (!socket_send(notifier->fd, pending, true))
+        notify_listener_stop();
+    }
+  } else if (ctx.engine == dm_kdialog) {
+    string str_text;
+    for (size_t i = 0; i < lines.size(); i++)
+      str_text += (i ? "\n" : "") + lines[i];
+    // neither waits for the popup to go away again
+    if (!notify_bus(ctx, str_text))
+      program_detach({ "kdialog", "--title", ctx.caption, "--passivepopup", str_text, "5" });
+  }
+}
+
+void notify_send_loop() {
+  std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now() - notify_interval;
+  std::unique_lock<std::mutex> lock(notifier->mutex);
+  for (;;) {
+    notifier->wake.wait(lock, [] { return !notifier->queue.empty(); });
+    lock.unlock();
+    std::this_thread::sleep_until(std::max(sent + notify_interval, std::chrono::steady_clock::now() + notify_gather));
+    lock.lock();
+    vector<string> batch;
+    batch.swap(notifier->queue);
+    lock.unlock();
+    notify_deliver(batch);
+    sent = std::chrono::steady_clock::now();
+    lock.lock();
+  }
 }
 
 } // anonymous namespace
 
 int show_message(char *str) {
-  message_cancel = false;
-  return show_message_helperfunc(str);
+  return show_message_helperfunc(DIALOG_MESSAGE, str);
 }
 
 int show_message_cancelable(char *str) {
-  message_cancel = true;
-  return show_message_helperfunc(str);
+  return show_message_helperfunc(DIALOG_MESSAGE_CANCELABLE, str);
 }
 
 int show_question(char *str) {
-  question_cancel = false;
-  return show_question_helperfunc(str);
+  return show_message_helperfunc(DIALOG_QUESTION, str);
 }
 
 int show_question_cancelable(char *str) {
-  question_cancel = true;
-  return show_question_helperfunc(str);
+  return show_message_helperfunc(DIALOG_QUESTION_CANCELABLE, str);
 }
 
 int show_attempt(char *str) {
-  change_relative_to_kwin();
-  string str_command;
-  string str_title = add_escaping(caption, true, "Error");
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
-  string caption_previous = caption;
-  caption = (str_title == "Error") ? "Error" : caption;
-
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
-
-  if (dm_dialogengine == dm_zenity) {
-    str_command = string("ans=$(zenity ") +
-    string("--question --ok-label=\"") + add_escaping(btn_array[BUTTON_RETRY], true, "") + string("\" --cancel-label=\"") + add_escaping(btn_array[BUTTON_CANCEL], true, "") + string("\" ") +  string("--title=\"") +
-    str_title + string("\" --no-wrap --text=\"") + add_escaping(str, false, "") +
-    string("\" --icon-name=dialog-error ") + str_icon + string(");if [ $? = 0 ] ;then echo 0;else echo -1;fi");
-  }
-  else if (dm_dialogengine == dm_kdialog) {
-    str_command = string("kdialog ") +
-    string("--warningyesno") + string(" \"") + add_escaping(str, false, "") + string("\" ") +
-    string("--yes-label \"") + add_escaping(btn_array[BUTTON_RETRY], true, "") + string("\" --no-label \"") + add_escaping(btn_array[BUTTON_CANCEL], true, "") + string("\" ") + string("--title \"") +
-    str_title + string("\" ") + str_icon + string(";") + string("x=$? ;if [ $x = 0 ] ;then echo 0;else echo -1;fi");
-  }
-
-  string str_result = shellscript_evaluate(str_command);
-  caption = caption_previous;
-  double result = strtod(str_result.c_str(), nullptr);
-  return (int)result;
+  return show_message_helperfunc(DIALOG_ATTEMPT, str);
 }
 
 int show_error(char *str, bool abort) {
-  change_relative_to_kwin();
-  string str_command;
-  string str_title = add_escaping(caption, true, "Error");
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
-  string caption_previous = caption;
-  caption = (str_title == "Error") ? "Error" : caption;
-  string str_echo;
-
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
-
-  if (dm_dialogengine == dm_zenity) {
-    str_echo = abort ? "echo 1" : "if [ $? = 0 ] ;then echo 1;else echo -1;fi";
-
-    if (abort) {
-      str_command = string("ans=$(zenity ") +
-      string("--info --ok-label=\"") + add_escaping(btn_array[BUTTON_ABORT], true, "") + string("\" ") +
-      string("--title=\"") + str_title + string("\" --no-wrap --text=\"") +
-      add_escaping(str, false, "") + string("\" --icon-name=dialog-error ") + str_icon + string(");") + str_echo;
-    } else {
-      str_command = string("ans=$(zenity ") +
-      string("--question --ok-label=\"") + add_escaping(btn_array[BUTTON_ABORT], true, "") + string("\" --cancel-label=\"") + add_escaping(btn_array[BUTTON_IGNORE], true, "") + string("\" ") +
-      string("--title=\"") + str_title + string("\" --no-wrap --text=\"") +
-      add_escaping(str, false, "") + string("\" --icon-name=dialog-error ") + str_icon + string(");") + str_echo;
-    }
-  }
-  else if (dm_dialogengine == dm_kdialog) {
-    str_echo = abort ? "echo 1" : "x=$? ;if [ $x = 0 ] ;then echo 1;elif [ $x = 1 ] ;then echo -1;fi";
-
-    if (abort) {
-      str_command = string("kdialog ") +
-      string("--sorry \"") + add_escaping(str, false, "") + string("\" ") +
-      string("--ok-label \"") + add_escaping(btn_array[BUTTON_ABORT], true, "") + string("\" ") +
-      string("--title \"") + str_title + string("\" ") + str_icon + string(";") + str_echo;
-    } else {
-      str_command = string("kdialog ") +
-      string("--warningyesno \"") + add_escaping(str, false, "") + string("\" ") +
-      string("--yes-label \"") + add_escaping(btn_array[BUTTON_ABORT], true, "") + string("\" --no-label \"") + add_escaping(btn_array[BUTTON_IGNORE], true, "") + string("\" ") +
-      string("--title \"") + str_title + string("\" ") + str_icon + string(";") + str_echo;
-    }
-  }
-
-  string str_result = shellscript_evaluate(str_command);
-  caption = caption_previous;
-  double result = strtod(str_result.c_str(), nullptr);
-  if (result == 1) exit(0);
-  return (int)result;
+  return show_message_helperfunc(abort ? DIALOG_ERROR_ABORT : DIALOG_ERROR, str);
 }
 
 char *get_string(char *str, char *def) {
-  change_relative_to_kwin();
-  string str_command;
-  string str_title = add_escaping(caption, true, "Input Query");
-  string caption_previous = caption;
-  caption = (str_title == "Input Query") ? "Input Query" : caption;
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
-
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
-
-  if (dm_dialogengine == dm_zenity) {
-    str_command = string("ans=$(zenity ") +
-    string("--entry --title=\"") + str_title + string("\"") + str_icon + string(" --text=\"") +
-    add_escaping(str, false, "") + string("\" --entry-text=\"") +
-    add_escaping(def, false, "") + string("\");echo $ans");
-  }
-  else if (dm_dialogengine == dm_kdialog) {
-    str_command = string("ans=$(kdialog ") +
-    string("--inputbox \"") + add_escaping(str, false, "") + string("\" \"") +
-    add_escaping(def, false, "") + string("\" --title \"") +
-    str_title + string("\"") + str_icon + string(");echo $ans");
-  }
-
-  static string result;
-  result = shellscript_evaluate(str_command);
-  caption = caption_previous;
-  return (char *)result.c_str();
+  return get_string_helperfunc(DIALOG_GET_STRING, str, def);
 }
 
 char *get_password(char *str, char *def) {
-  change_relative_to_kwin();
-  string str_command;
-  string str_title = add_escaping(caption, true, "Input Query");
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
-  string caption_previous = caption;
-  caption = (str_title == "Input Query") ? "Input Query" : caption;
-
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
-
-  if (dm_dialogengine == dm_zenity) {
-    str_command = string("ans=$(zenity ") +
-    string("--entry --title=\"") + str_title + string("\"") + str_icon + string(" --text=\"") +
-    add_escaping(str, false, "") + string("\" --hide-text --entry-text=\"") +
-    add_escaping(def, false, "") + string("\");echo $ans");
-  }
-  else if (dm_dialogengine == dm_kdialog) {
-    str_command = string("ans=$(kdialog ") +
-    string("--password \"") + add_escaping(str, false, "") + string("\" \"") +
-    add_escaping(def, false, "") + string("\" --title \"") +
-    str_title + string("\"") + str_icon + string(");echo $ans");
-  }
-
-  static string result;
-  result = shellscript_evaluate(str_command);
-  caption = caption_previous;
-  return (char *)result.c_str();
+  return get_string_helperfunc(DIALOG_GET_PASSWORD, str, def);
 }
 
 double get_integer(char *str, double def) {
@@ -789,51 +3898,109 @@ double get_passcode(char *str, double def) {
   return result;
 }
 
-char *get_open_filename(char *filter, char *fname) {
-  return get_open_filename_ext(filter, fname, (char *)"", (char *)"Open");
+char *get_form(char *str, char *fields) {
+  metrics_dialog(metric_form);
+  dialog_context ctx = capture_context(nullptr, "Input Query");
+  vector<form_field> form = form_fields(fields);
+  const string &str_command = form_command(ctx, str, form);
+  thread_local string result;
+  result = form_result(form, shellscript_evaluate(str_command, ctx));
+  return (char *)result.c_str();
 }
 
-char *get_open_filename_ext(char *filter, char *fname, char *dir, char *title) {
-  change_relative_to_kwin();
-  string str_command; string pwd;
-  string str_title = add_escaping(title, true, "Open");
-  string caption_previous = caption;
-  caption = (str_title == "Open") ? "Open" : title;
-  string str_fname = filename_name(filename_absolute(fname));
-  string str_dir = filename_absolute(dir);
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
+char *get_list(char *str, char *column, list_next_t next, void *data) {
+  metrics_dialog(metric_list);
+  dialog_context ctx = capture_context(nullptr, "Select");
+  thread_local string result;
+  result = "";
+  if (ctx.gtk)
+    result = list_gtk(ctx, str, column, next, data);
+  else if (ctx.engine == dm_zenity)
+    result = list_zenity(ctx, str, column, next, data);
+  else if (ctx.engine == dm_kdialog)
+    result = list_kdialog(ctx, str, column, next, data);
+  return (char *)result.c_str();
+}
 
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
+char *get_list_file(char *str, char *column, char *fname) {
+  list_file lf = { fopen(fname, "r"), nullptr, 0 };
+  if (!lf.file) return (char *)"";
+  char *result = get_list(str, column, list_file_next, &lf);
+  free(lf.buffer);
+  fclose(lf.file);
+  return result;
+}
 
-  string str_path = fname;
-  if (str_dir[0] != '\0') str_path = str_dir + string("/") + str_fname;
-  str_fname = (char *)str_path.c_str();
+void notify(char *str) {
+  metrics_dialog(metric_notify);
+  std::lock_guard<std::mutex> lock(notifier->mutex);
+  notifier->queue.push_back(str ? str : "");
+  if (!notifier->started) {
+    notifier->started = true;
+    std::thread(notify_send_loop).detach();
+  }
+  notifier->wake.notify_one();
+}
 
-  if (dm_dialogengine == dm_zenity) {
-    str_command = string("ans=$(zenity ") +
-    string("--file-selection --title=\"") + str_title + string("\" --filename=\"") +
-    add_escaping(str_fname, false, "") + string("\"") + zenity_filter(filter) + str_icon + string(");echo $ans");
+int show_text_fd(int fd) {
+  metrics_dialog(metric_text);
+  dialog_context ctx = capture_context(nullptr, "Information");
+  command_builder &command = command_begin();
+
+  if (ctx.engine == dm_zenity) {
+    command.text("zenity --text-info --title=\"").escaped(ctx.caption).text("\" --ok-label=\"").
+    escaped(ctx.btn_array[BUTTON_OK]).text("\" --cancel-label=\"").
+    escaped(ctx.btn_array[BUTTON_CANCEL]).text("\"").icon(ctx).text(";exit $?");
+  }
+  else if (ctx.engine == dm_kdialog) {
+    command.text("kdialog --textbox /dev/stdin --title \"").escaped(ctx.caption).text("\"").icon(ctx).text(";exit $?");
   }
-  else if (dm_dialogengine == dm_kdialog) {
-    pwd = ""; if (str_fname.c_str() && str_fname[0] != '/' && str_fname.length()) pwd = string("\"$PWD/\"") +
-      string("\"") + add_escaping(str_fname, false, "") + string("\""); else pwd = "\"$PWD/\"";
+  else return 0;
 
-    str_command = string("ans=$(kdialog ") +
-    string("--getopenfilename ") + pwd + kdialog_filter(filter) +
-    string(" --title \"") + str_title + string("\"") + str_icon + string(");echo $ans");
+  const string &str_command = command.finish();
+
+  DLGMOD_PROBE1(dialog__start, str_command.c_str());
+  int status = 0;
+  if (ctx.mock) {
+    status = (int)strtol(mock_evaluate().c_str(), nullptr, 10);
+    DLGMOD_PROBE1(dialog__end, (status == 0) ? "1" : "-1");
+    return (status == 0) ? 1 : -1;
+  }
+  int fd_pipe[2];
+  if (pipe2(fd_pipe, O_CLOEXEC) == -1) return 0;
+  int fd_null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  process_t ppid = process_spawn(str_command, fd_pipe[0], fd_null, false);
+  close(fd_pipe[0]);
+  if (fd_null != -1) close(fd_null);
+  if (ppid == -1) {
+    close(fd_pipe[1]);
+    return 0;
   }
+  process_t pid = modify_dialog(ppid, ctx);
+  text_feed(fd, fd_pipe[1]);
+  close(fd_pipe[1]);
+  waitpid(ppid, &status, 0);
+  DLGMOD_PROBE2(child__reaped, (int)ppid, status);
+  modify_dialog_reap(pid);
+  int result = (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 1 : -1;
+  DLGMOD_PROBE1(dialog__end, (result == 1) ? "1" : "-1");
+  return result;
+}
 
-  static string result;
-  result = shellscript_evaluate(str_command);
-  caption = caption_previous;
+int show_text_file(char *fname) {
+  int fd = open(fname, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return 0;
+  int result = show_text_fd(fd);
+  close(fd);
+  return result;
+}
 
-  if (file_exists(result))
-    return (char *)result.c_str();
+char *get_open_filename(char *filter, char *fname) {
+  return get_open_filename_ext(filter, fname, (char *)"", (char *)"Open");
+}
 
-  return (char *)"";
+char *get_open_filename_ext(char *filter, char *fname, char *dir, char *title) {
+  return get_filename_helperfunc(DIALOG_OPEN_FILENAME, filter, fname, dir, title);
 }
 
 char *get_open_filenames(char *filter, char *fname) {
@@ -841,53 +4008,7 @@ char *get_open_filenames(char *filter, char *fname) {
 }
 
 char *get_open_filenames_ext(char *filter, char *fname, char *dir, char *title) {
-  change_relative_to_kwin();
-  string str_command; string pwd;
-  string str_title = add_escaping(title, true, "Open");
-  string caption_previous = caption;
-  caption = (str_title == "Open") ? "Open" : title;
-  string str_fname = filename_name(filename_absolute(fname));
-  string str_dir = filename_absolute(dir);
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
-
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
-
-  string str_path = fname;
-  if (str_dir[0] != '\0') str_path = str_dir + string("/") + str_fname;
-  str_fname = (char *)str_path.c_str();
-
-  if (dm_dialogengine == dm_zenity) {
-    str_command = string("zenity ") +
-    string("--file-selection --multiple --separator='\n' --title=\"") + str_title + string("\" --filename=\"") +
-    add_escaping(str_fname, false, "") + string("\"") + zenity_filter(filter) + str_icon;
-  }
-  else if (dm_dialogengine == dm_kdialog) {
-    pwd = ""; if (str_fname.c_str() && str_fname[0] != '/' && str_fname.length()) pwd = string("\"$PWD/\"") +
-      string("\"") + add_escaping(str_fname, false, "") + string("\""); else pwd = "\"$PWD/\"";
-
-    str_command = string("kdialog ") +
-    string("--getopenfilename ") + pwd + kdialog_filter(filter) +
-    string(" --multiple --separate-output --title \"") + str_title + string("\"") + str_icon;
-  }
-
-  static string result;
-  result = shellscript_evaluate(str_command);
-  caption = caption_previous;
-  std::vector<string> stringVec = string_split(result, '\n');
-
-  bool success = true;
-  for (const string &str : stringVec) {
-    if (!file_exists(str))
-      success = false;
-  }
-
-  if (success)
-    return (char *)result.c_str();
-
-  return (char *)"";
+  return get_filename_helperfunc(DIALOG_OPEN_FILENAMES, filter, fname, dir, title);
 }
 
 char *get_save_filename(char *filter, char *fname) {
@@ -895,42 +4016,7 @@ char *get_save_filename(char *filter, char *fname) {
 }
 
 char *get_save_filename_ext(char *filter, char *fname, char *dir, char *title) {
-  change_relative_to_kwin();
-  string str_command; string pwd;
-  string str_title = add_escaping(title, true, "Save As");
-  string caption_previous = caption;
-  caption = (str_title == "Save As") ? "Save As" : title;
-  string str_fname = filename_name(filename_absolute(fname));
-  string str_dir = filename_absolute(dir);
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
-
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
-
-  string str_path = fname;
-  if (str_dir[0] != '\0') str_path = str_dir + string("/") + str_fname;
-  str_fname = (char *)str_path.c_str();
-
-  if (dm_dialogengine == dm_zenity) {
-    str_command = string("ans=$(zenity ") +
-    string("--file-selection  --save --confirm-overwrite --title=\"") + str_title + string("\" --filename=\"") +
-    add_escaping(str_fname, false, "") + string("\"") + zenity_filter(filter) + str_icon + string(");echo $ans");
-  }
-  else if (dm_dialogengine == dm_kdialog) {
-    pwd = ""; if (str_fname.c_str() && str_fname[0] != '/' && str_fname.length()) pwd = string("\"$PWD/\"") +
-      string("\"") + add_escaping(str_fname, false, "") + string("\""); else pwd = "\"$PWD/\"";
-
-    str_command = string("ans=$(kdialog ") +
-    string("--getsavefilename ") + pwd + kdialog_filter(filter) +
-    string(" --title \"") + str_title + string("\"") + str_icon + string(");echo $ans");
-  }
-
-  static string result;
-  result = shellscript_evaluate(str_command);
-  caption = caption_previous;
-  return (char *)result.c_str();
+  return get_filename_helperfunc(DIALOG_SAVE_FILENAME, filter, fname, dir, title);
 }
 
 char *get_directory(char *dname) {
@@ -938,37 +4024,7 @@ char *get_directory(char *dname) {
 }
 
 char *get_directory_alt(char *capt, char *root) {
-  change_relative_to_kwin();
-  string str_command; string pwd;
-  string str_title = add_escaping(capt, true, "Select Directory");
-  string caption_previous = caption;
-  caption = (str_title == "Select Directory") ? "Select Directory" : capt;
-  string str_dname = root;
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
-  string str_end = ");if [ $ans = / ] ;then echo $ans;elif [ $? = 1 ] ;then echo $ans/;else echo $ans;fi";
-
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
-
-  if (dm_dialogengine == dm_zenity) {
-    str_command = string("ans=$(zenity ") +
-    string("--file-selection --directory --title=\"") + str_title + string("\" --filename=\"") +
-    add_escaping(str_dname, false, "") + string("\"") + str_icon + str_end;
-  }
-  else if (dm_dialogengine == dm_kdialog) {
-    if (str_dname.c_str() && str_dname[0] != '/' && str_dname.length()) pwd = string("\"$PWD/\"") +
-      string("\"") + add_escaping(str_dname, false, "") + string("\""); else pwd = "\"$PWD/\"";
-
-    str_command = string("ans=$(kdialog ") +
-    string("--getexistingdirectory ") + pwd + string(" --title \"") + str_title + string("\"") + str_icon + str_end;
-  }
-
-  static string result;
-  result = shellscript_evaluate(str_command);
-  caption = caption_previous;
-  return (char *)result.c_str();
+  return get_filename_helperfunc(DIALOG_DIRECTORY, nullptr, root, (char *)"", capt);
 }
 
 int get_color(int defcol) {
@@ -976,136 +4032,459 @@ int get_color(int defcol) {
 }
 
 int get_color_ext(int defcol, char *title) {
-  change_relative_to_kwin();
-  string str_command;
-  string str_title = add_escaping(title, true, "Color");
-  string caption_previous = caption;
-  caption = (str_title == "Color") ? "Color" : title;
-  string str_defcol;
+  metrics_dialog(metric_color);
+  dialog_context ctx = capture_context(title, "Color");
   string str_result;
-  string str_iconflag = (dm_dialogengine == dm_zenity) ? " --window-icon=\"" : " --icon \"";
-  if (current_icon == "") current_icon = filename_absolute("assets/icon.png");
-  string str_icon = file_exists(current_icon) ? str_iconflag + add_escaping(current_icon, false, "") + string("\"") : "";
-
-  wid_t window = owner ? ((dm_dialogengine == dm_zenity) ? "echo " : "") +
-    wid_from_window((unsigned long)owner) : wid_from_top();
 
   int red; int green; int blue;
   red = color_get_red(defcol);
   green = color_get_green(defcol);
   blue = color_get_blue(defcol);
 
-  if (dm_dialogengine == dm_zenity) {
-    str_defcol = string("rgb(") + std::to_string(red) + string(",") +
-    std::to_string(green) + string(",") + std::to_string(blue) + string(")");
-    str_command = string("ans=$(zenity ") +
-    string("--color-selection --show-palette --title=\"") + str_title + string("\" --color='") +
-    str_defcol + string("'") + str_icon + string(");if [ $? = 0 ] ;then echo $ans;else echo -1;fi");
-
-    str_result = shellscript_evaluate(str_command);
-    caption = caption_previous;
-    if (str_result == "-1") return strtod(str_result.c_str(), nullptr);
-    str_result = string_replace_all(str_result, "rgba(", "");
-    str_result = string_replace_all(str_result, "rgb(", "");
-    str_result = string_replace_all(str_result, ")", "");
-    std::vector<string> stringVec = string_split(str_result, ',');
+  if (ctx.gtk) {
+    int result = -1;
+    gtk_invoke([&]() {
+      void *dialog = gtk.color_chooser_dialog_new(ctx.caption.c_str(), nullptr);
+      gtk_decorate(dialog, ctx);
+      gtk_rgba rgba = { red / 255.0, green / 255.0, blue / 255.0, 1 };
+      gtk.color_chooser_set_use_alpha(dialog, false);
+      gtk.color_chooser_set_rgba(dialog, &rgba);
+      if (gtk.dialog_run(dialog) == gtk_response_ok) {
+        gtk.color_chooser_get_rgba(dialog, &rgba);
+        result = make_color_rgb((unsigned char)(rgba.red * 255 + 0.5),
+          (unsigned char)(rgba.green * 255 + 0.5), (unsigned char)(rgba.blue * 255 + 0.5));
+      }
+      gtk.widget_destroy(dialog);
+    });
+    return result;
+  }
 
-    unsigned int index = 0;
-    for (const string &str : stringVec) {
-      if (index == 0) red = strtod(str.c_str(), nullptr);
-      if (index == 1) green = strtod(str.c_str(), nullptr);
-      if (index == 2) blue = strtod(str.c_str(), nullptr);
-      index += 1;
-    }
+  if (ctx.engine == dm_zenity) {
+    const string &str_command = command_begin().text("ans=$(zenity ").
+    text("--color-selection --show-palette --title=\"").escaped(ctx.caption).text("\" --color='").
+    text("rgb(").number(red).text(",").number(green).text(",").number(blue).text(")").
+    text("'").icon(ctx).text(");if [ $? = 0 ] ;then echo $ans;else echo -1;fi").finish();
 
-  } else if (dm_dialogengine == dm_kdialog) {
+    str_result = shellscript_evaluate(str_command, ctx);
+    if (str_result == "-1") return strtod(str_result.c_str(), nullptr);
+    return zenity_color(str_result, defcol);
+  } else if (ctx.engine == dm_kdialog) {
     char hexcol[16];
-    snprintf(hexcol, sizeof(hexcol), "%02x%02x%02x", red, green, blue);
-
-    str_defcol = string("#") + string(hexcol);
-    std::transform(str_defcol.begin(), str_defcol.end(), str_defcol.begin(), ::toupper);
+    snprintf(hexcol, sizeof(hexcol), "%02X%02X%02X", red, green, blue);
 
-    str_command = string("ans=$(kdialog ") +
-    string("--getcolor --default '") + str_defcol + string("' --title \"") + str_title +
-    string("\"") + str_icon + string(");if [ $? = 0 ] ;then echo $ans;else echo -1;fi");
+    const string &str_command = command_begin().text("ans=$(kdialog ").
+    text("--getcolor --default '#").text(hexcol).text("' --title \"").escaped(ctx.caption).
+    text("\"").icon(ctx).text(");if [ $? = 0 ] ;then echo $ans;else echo -1;fi").finish();
 
-    str_result = shellscript_evaluate(str_command);
-    caption = caption_previous;
+    str_result = shellscript_evaluate(str_command, ctx);
     if (str_result == "-1") return strtod(str_result.c_str(), nullptr);
-    str_result = str_result.substr(1, str_result.length() - 1);
-
-    unsigned int color;
-    std::stringstream ss2;
-    ss2 << std::hex << str_result;
-    ss2 >> color;
-
-    blue = color_get_red(color);
-    green = color_get_green(color);
-    red = color_get_blue(color);
+    return kdialog_color(str_result);
   }
 
   return (int)make_color_rgb(red, green, blue);
 }
 
 char *widget_get_caption() {
-  return (char *)caption.c_str();
+  thread_local string result;
+  result = settings_snapshot()->caption;
+  return (char *)result.c_str();
 }
 
 void widget_set_caption(char *title) {
-  caption = title ? title : "";
+  string str_title = title ? title : "";
+  settings_modify([&str_title](dialog_settings &next) { next.caption = str_title; });
 }
 
 char *widget_get_owner() {
-  static wid_t result;
-  result = wid_from_window((unsigned long)owner);
+  thread_local wid_t result;
+  result = wid_from_window((unsigned long)settings_snapshot()->owner);
   return (char *)result.c_str();
 }
 
 void widget_set_owner(char *hwnd) {
   wid_t str_hwnd = hwnd;
-  owner = (void *)window_from_wid(str_hwnd);
+  xcb_window_t window = (xcb_window_t)window_from_wid(str_hwnd);
+  settings_modify([window](dialog_settings &next) { next.owner = window; });
 }
 
 char *widget_get_icon() {
-  if (current_icon == "") 
-    current_icon = filename_absolute("assets/icon.png");
-  return (char *)current_icon.c_str();
+  thread_local string result;
+  result = settings_snapshot()->current_icon;
+  if (result == "")
+    result = filename_absolute("assets/icon.png");
+  return (char *)result.c_str();
 }
 
 void widget_set_icon(char *icon) {
-  current_icon = filename_absolute(icon);
+  string str_icon = filename_absolute(icon);
+  settings_modify([&str_icon](dialog_settings &next) { next.current_icon = str_icon; });
 }
 
 char *widget_get_system() {
-  if (dm_dialogengine == dm_zenity)
+  int engine = settings_snapshot()->engine;
+
+  if (engine == dm_zenity)
     return (char *)"Zenity";
 
-  if (dm_dialogengine == dm_kdialog)
+  if (engine == dm_kdialog)
     return (char *)"KDialog";
 
+  if (engine == dm_gtk)
+    return (char *)"GTK";
+
+  if (engine == dm_portal)
+    return (char *)"Portal";
+
+  if (engine == dm_mock)
+    return (char *)"Mock";
+
   return (char *)"X11";
 }
 
 void widget_set_system(char *sys) {
   string str_sys = sys;
-  
-  if (str_sys == "X11")
-    dm_dialogengine = dm_x11;
-
-  if (str_sys == "Zenity")
-    dm_dialogengine = dm_zenity;
+  int engine;
 
-  if (str_sys == "KDialog")
-    dm_dialogengine = dm_kdialog;
+  if (str_sys == "X11")
+    engine = dm_x11;
+  else if (str_sys == "Zenity")
+    engine = dm_zenity;
+  else if (str_sys == "KDialog")
+    engine = dm_kdialog;
+  else if (str_sys == "GTK")
+    engine = dm_gtk;
+  else if (str_sys == "Portal")
+    engine = dm_portal;
+  else if (str_sys == "Mock")
+    engine = dm_mock;
+  else return;
+
+  settings_modify([engine](dialog_settings &next) { next.engine = engine; });
 }
 
 void widget_set_button_name(int type, char *name) {
   string str_name = name;
-  btn_array[type] = str_name;
+  settings_modify([type, &str_name](dialog_settings &next) { next.btn_array[type] = str_name; });
 }
 
 char *widget_get_button_name(int type) {
-  return (char *)btn_array[type].c_str();
+  thread_local string result;
+  result = settings_snapshot()->btn_array[type];
+  return (char *)result.c_str();
+}
+
+int widget_get_daemon() {
+  return daemon_enabled.load();
+}
+
+void widget_set_daemon(int enable) {
+  daemon_enabled.store(enable != 0);
+}
+
+void daemon_main() {
+  signal(SIGPIPE, SIG_IGN);
+  daemon_serve();
+}
+
+int widget_get_tracing() {
+  return trace_enabled.load();
+}
+
+void widget_set_tracing(int enable) {
+  trace_enabled.store(enable != 0);
+}
+
+int widget_get_utf8_repair() {
+  return utf8_repair.load();
+}
+
+void widget_set_utf8_repair(int enable) {
+  utf8_repair.store(enable != 0);
+}
+
+int widget_get_counters() {
+  return counters_enabled.load();
+}
+
+void widget_set_counters(int enable) {
+  counters_enabled.store(enable != 0);
+}
+
+int dialog_trace_dump(char *path) {
+  vector<trace_ring *> rings;
+  {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    rings = trace_rings;
+  }
+  FILE *file = fopen(path, "w");
+  if (!file) return 0;
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+  bool first = true;
+  std::map<uint32_t, bool> processes;
+  for (trace_ring *ring : rings) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t begin = (head > trace_capacity) ? head - trace_capacity : 0;
+    for (uint64_t i = begin; i < head; i++) {
+      trace_span &span = ring->spans[i % trace_capacity];
+      const char *name = span.name.load(std::memory_order_relaxed);
+      uint64_t start = span.start.load(std::memory_order_relaxed);
+      uint64_t end = span.end.load(std::memory_order_relaxed);
+      uint32_t pid = span.pid.load(std::memory_order_relaxed);
+      uint32_t tid = span.tid.load(std::memory_order_relaxed);
+      // the owner may have lapped the ring and be rewriting this slot
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (i + trace_capacity <= ring->head.load(std::memory_order_relaxed)) continue;
+      fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"dlgmod\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u}",
+        first ? "" : ",", name, start / 1000.0, (end - start) / 1000.0, pid, tid);
+      first = false;
+      processes[pid] = true;
+    }
+  }
+  for (const std::pair<const uint32_t, bool> &process : processes) {
+    fprintf(file, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"%s\"}}",
+      first ? "" : ",", process.first, (process.first == (uint32_t)getpid()) ? "dlgmod" : "decorator");
+    first = false;
+  }
+  fputs("]}\n", file);
+  return (fclose(file) == 0);
+}
+
+void dialog_mock_push(char *answer, double delay) {
+  mock_answer next;
+  next.text = answer ? answer : "";
+  next.delay = delay;
+  std::lock_guard<std::mutex> lock(mock_mutex);
+  mock_queue.push_back(next);
+}
+
+// one answer per line, optionally after its delay in ms and a tab; \n in a
+// line stands for a line break, for multiple file selections
+int dialog_mock_load(char *fname) {
+  FILE *file = fopen(fname, "r");
+  if (!file) return 0;
+  vector<mock_answer> answers;
+  char *buffer = nullptr;
+  size_t buffer_size = 0;
+  ssize_t length;
+  while ((length = getline(&buffer, &buffer_size, file)) != -1) {
+    string line(buffer, length);
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+      line.pop_back();
+    mock_answer next;
+    size_t tab = line.find('\t');
+    if (tab != string::npos) {
+      next.delay = strtod(line.substr(0, tab).c_str(), nullptr);
+      line.erase(0, tab + 1);
+    }
+    next.text = string_replace_all(line, "\\n", "\n");
+    answers.push_back(next);
+  }
+  free(buffer);
+  fclose(file);
+  std::lock_guard<std::mutex> lock(mock_mutex);
+  mock_queue.insert(mock_queue.end(), answers.begin(), answers.end());
+  return (int)answers.size();
+}
+
+void dialog_mock_clear() {
+  std::lock_guard<std::mutex> lock(mock_mutex);
+  mock_queue.clear();
+  mock_last = mock_answer();
+}
+
+// the counters as JSON; phase times are in microseconds, bucket i of a
+// phase counting the spans that took under 2^i us but not under 2^(i-1)
+char *dialog_metrics_snapshot() {
+  dialog_metrics &current = metrics();
+  std::ostringstream json;
+  json << "{\"dialogs\":{";
+  for (int i = 0; i < metric_dialogs; i++)
+    json << (i ? "," : "") << "\"" << metric_dialog_names[i] << "\":" << current.dialogs[i].load(std::memory_order_relaxed);
+  json << "}";
+  for (int i = 0; i < metric_counters; i++)
+    json << ",\"" << metric_counter_names[i] << "\":" << current.counters[i].load(std::memory_order_relaxed);
+  json << ",\"phases\":{";
+  for (int i = 0; i < trace_phases; i++) {
+    uint64_t count = 0;
+    std::ostringstream buckets;
+    for (unsigned j = 0; j < metric_buckets; j++) {
+      uint64_t bucket = current.phase_buckets[i][j].load(std::memory_order_relaxed);
+      buckets << (j ? "," : "") << bucket;
+      count += bucket;
+    }
+    json << (i ? "," : "") << "\"" << trace_phase_names[i] << "\":{\"count\":" << count <<
+      ",\"total_us\":" << current.phase_total[i].load(std::memory_order_relaxed) << ",\"buckets\":[" << buckets.str() << "]}";
+  }
+  json << "}}";
+  thread_local string result;
+  result = json.str();
+  return (char *)result.c_str();
+}
+
+// the hardware counters per site as JSON, with null for the events no
+// thread could count; task_ns is CPU time in nanoseconds
+char *dialog_counters_snapshot() {
+  dialog_metrics &current = metrics();
+  uint32_t counted = current.events_counted.load(std::memory_order_relaxed);
+  std::ostringstream json;
+  json << "{\"enabled\":" << (counters_enabled.load() ? "true" : "false") <<
+    ",\"groups_failed\":" << current.groups_failed.load(std::memory_order_relaxed) << ",\"sites\":{";
+  for (int i = 0; i < counter_sites; i++) {
+    json << (i ? "," : "") << "\"" << counter_site_names[i] << "\":{\"calls\":" <<
+      current.site_calls[i].load(std::memory_order_relaxed);
+    for (int j = 0; j < counter_events; j++) {
+      json << ",\"" << counter_event_names[j] << "\":";
+      if (counted & (1u << j)) json << current.site_events[i][j].load(std::memory_order_relaxed);
+      else json << "null";
+    }
+    json << "}";
+  }
+  json << "}}";
+  thread_local string result;
+  result = json.str();
+  return (char *)result.c_str();
+}
+
+int widget_save_settings() {
+  std::lock_guard<std::mutex> lock(settings_writer_mutex);
+  int id = settings_saved_id++;
+  settings_saved[id] = *settings_snapshot();
+  return id;
+}
+
+void widget_restore_settings(int id) {
+  std::lock_guard<std::mutex> lock(settings_writer_mutex);
+  std::map<int, dialog_settings>::iterator saved = settings_saved.find(id);
+  if (saved != settings_saved.end())
+    settings_publish(std::make_shared<dialog_settings>(saved->second));
+}
+
+void widget_free_settings(int id) {
+  std::lock_guard<std::mutex> lock(settings_writer_mutex);
+  settings_saved.erase(id);
+}
+
+void widget_use_settings(int id) {
+  std::lock_guard<std::mutex> lock(settings_writer_mutex);
+  std::map<int, dialog_settings>::iterator saved = settings_saved.find(id);
+  if (saved != settings_saved.end()) settings_thread = std::make_shared<dialog_settings>(saved->second);
+  else settings_thread.reset();
+}
+
+int dialog_prepare(int type, char *title, char *filter) {
+  if (type < DIALOG_MESSAGE || type > DIALOG_DIRECTORY) return -1;
+  // message and input dialogs fall back on the widget caption, file dialogs on their default title
+  const char *str_title = (!is_file_dialog(type) && (!title || !*title)) ? nullptr : (title ? title : "");
+  std::shared_ptr<dialog_template> tpl = std::make_shared<dialog_template>(make_template(type, str_title, filter));
+  if (!is_file_dialog(type)) {
+    // build the command around two one-character texts and keep the pieces
+    // either side of where they differ; a control byte as a marker would be
+    // replaced like any other in the text
+    string first = message_command(*tpl, "0", "");
+    const string &second = message_command(*tpl, "1", "");
+    size_t pos = std::mismatch(first.begin(), first.end(), second.begin()).first - first.begin();
+    tpl->prefix = first.substr(0, pos);
+    if (pos < first.length())
+      tpl->suffix = first.substr(pos + 1);
+  }
+  std::lock_guard<std::mutex> lock(prepared_mutex);
+  int id = prepared_id++;
+  prepared_dialogs[id] = tpl;
+  return id;
+}
+
+int dialog_prepared_show(int id, char *str) {
+  std::shared_ptr<const dialog_template> tpl = prepared_find(id);
+  if (!tpl || is_file_dialog(tpl->type)) return 0;
+  metrics_count(metric_prepared_hits);
+  metrics_dialog(tpl->type);
+  if (tpl->ctx.gtk) return message_result(tpl->type, gtk_message(tpl->ctx, tpl->type, utf8_text(str), ""));
+  string result;
+  if (daemon_message(tpl->ctx, tpl->type, str, "", result)) return message_result(tpl->type, result);
+  const string &str_command = command_begin().text(tpl->prefix).escaped(str).text(tpl->suffix).finish();
+  return message_result(tpl->type, shellscript_evaluate(str_command, tpl->ctx));
+}
+
+char *dialog_prepared_get(int id, char *str) {
+  std::shared_ptr<const dialog_template> tpl = prepared_find(id);
+  if (!tpl) return (char *)"";
+  metrics_count(metric_prepared_hits);
+  metrics_dialog(tpl->type);
+  thread_local string result;
+  if (tpl->ctx.gtk) {
+    if (is_file_dialog(tpl->type)) result = file_result(tpl->type, gtk_file(*tpl, str, (char *)""));
+    else result = gtk_message(tpl->ctx, tpl->type, utf8_text(str), "");
+  } else if (is_file_dialog(tpl->type)) {
+    if (!(tpl->ctx.portal && portal_file(*tpl, str, (char *)"", result)) && !daemon_file(*tpl, str, (char *)"", result)) {
+      const string &str_command = file_command(*tpl, str, (char *)"");
+      result = shellscript_evaluate(str_command, tpl->ctx);
+    }
+    result = file_result(tpl->type, result);
+  } else if (!daemon_message(tpl->ctx, tpl->type, str, "", result)) {
+    const string &str_command = command_begin().text(tpl->prefix).escaped(str).text(tpl->suffix).finish();
+    result = shellscript_evaluate(str_command, tpl->ctx);
+  }
+  return (char *)result.c_str();
+}
+
+void dialog_prepared_free(int id) {
+  std::lock_guard<std::mutex> lock(prepared_mutex);
+  prepared_dialogs.erase(id);
+}
+
+int progress_open(char *str) {
+  int id = -1;
+  for (int i = 0; i < progress_max && id == -1; i++) {
+    int expected = PROGRESS_FREE;
+    if (progress_dialogs[i].state.compare_exchange_strong(expected, PROGRESS_OPENING))
+      id = i;
+  }
+  if (id == -1) return -1;
+  metrics_dialog(metric_progress);
+  progress_dialog *dlg = &progress_dialogs[id];
+  dlg->ctx = capture_context(nullptr, "Progress");
+  dlg->value.store(0, std::memory_order_relaxed);
+  dlg->closing = false;
+  dlg->text = str ? str : "";
+  dlg->text_serial = 0;
+  if (!progress_start(dlg)) {
+    dlg->state.store(PROGRESS_FREE, std::memory_order_release);
+    return -1;
+  }
+  dlg->alive.store(true, std::memory_order_relaxed);
+  dlg->writer = std::thread(progress_write, dlg);
+  dlg->state.store(PROGRESS_OPEN, std::memory_order_release);
+  return id;
+}
+
+int progress_update(int id, double value) {
+  progress_dialog *dlg = progress_find(id);
+  if (!dlg || dlg->state.load(std::memory_order_acquire) != PROGRESS_OPEN) return 0;
+  dlg->value.store(value, std::memory_order_relaxed);
+  return dlg->alive.load(std::memory_order_relaxed);
+}
+
+void progress_set_text(int id, char *str) {
+  progress_dialog *dlg = progress_find(id);
+  if (!dlg || dlg->state.load(std::memory_order_acquire) != PROGRESS_OPEN) return;
+  std::lock_guard<std::mutex> lock(dlg->mutex);
+  dlg->text = str ? str : "";
+  dlg->text_serial++;
+}
+
+void progress_close(int id) {
+  progress_dialog *dlg = progress_find(id);
+  int expected = PROGRESS_OPEN;
+  if (!dlg || !dlg->state.compare_exchange_strong(expected, PROGRESS_CLOSING)) return;
+  {
+    std::lock_guard<std::mutex> lock(dlg->mutex);
+    dlg->closing = true;
+  }
+  dlg->wake.notify_one();
+  dlg->writer.join();
+  progress_stop(dlg);
+  dlg->alive.store(false, std::memory_order_relaxed);
+  dlg->state.store(PROGRESS_FREE, std::memory_order_release);
 }
 
 } // namepace dialog_module